@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>  // for memset()
+#include <time.h>    // for nanosleep()
+#include "ahead.h"
+
+static void *ahead_worker(void *arg)
+{
+  /* Keeps the FIFO topped up, one device buffer at a time, and naps
+     for a fraction of a buffer whenever it is full. */
+  RenderAhead *ra = arg;
+  float block[FRAMES_PER_BUFFER * NUM_CHAN];
+  struct timespec nap = {0, (long)(1e9 * FRAMES_PER_BUFFER / SAMP_RATE / 4)};
+
+  /* All the DSP happens here now, so with -R this thread needs the
+     same protection as the callback: one priority below it, so the
+     callback's copy still preempts it, and on the same CPU */
+  if (ra->rt)
+    rt_prepare_worker(ra->rt, ra->rt->priority - 1, ra->rt->cpu);
+
+  while (atomic_load_explicit(&ra->running, memory_order_relaxed)) {
+    if (fifo_avail(&ra->fifo) + FRAMES_PER_BUFFER * NUM_CHAN <= ra->target) {
+      control_render(ra->ctl, ra->lc, ra->tp, ra->ps, ra->pm, block,
+        FRAMES_PER_BUFFER);
+      fifo_write(&ra->fifo, block, FRAMES_PER_BUFFER * NUM_CHAN);
+    } else {
+      nanosleep(&nap, NULL);
+    }
+  }
+  return NULL;
+}
+
+int ahead_start(RenderAhead *ra, int blocks, Control *ctl, LoopCache *lc,
+  TrackPool *tp, Synth *ps, Melody *pm, const RtConfig *rt)
+{
+  /* Starts the worker and waits for it to fill the FIFO once,
+     so the first callbacks don't run dry. */
+  struct timespec nap = {0, 1000000};
+
+  if (blocks < 1)
+    blocks = 1;
+  if (blocks > AHEAD_MAX_BLOCKS)
+    blocks = AHEAD_MAX_BLOCKS;
+  ra->target = (size_t)blocks * FRAMES_PER_BUFFER * NUM_CHAN;
+  ra->ctl = ctl;
+  ra->lc = lc;
+  ra->tp = tp;
+  ra->ps = ps;
+  ra->pm = pm;
+  ra->rt = rt;
+  atomic_init(&ra->underruns, 0);
+  atomic_init(&ra->dry_frames, 0);
+  atomic_init(&ra->running, 1);
+
+  if (fifo_init(&ra->fifo, ra->target) < 0) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return -1;
+  }
+  if (pthread_create(&ra->thread, NULL, ahead_worker, ra) != 0) {
+    fprintf(stderr, "ERROR: could not start render-ahead thread\n");
+    fifo_free(&ra->fifo);
+    return -1;
+  }
+  for (int i = 0; i < 1000 && fifo_avail(&ra->fifo) < ra->target; i++)
+    nanosleep(&nap, NULL);
+  return 0;
+}
+
+void ahead_read(RenderAhead *ra, float *output, unsigned long frames)
+{
+  /* Audio thread: copies out the next frames. If the worker fell
+     behind, the rest of the buffer is silence and counted. */
+  size_t want = frames * NUM_CHAN;
+  size_t got = fifo_read(&ra->fifo, output, want);
+
+  if (got < want) {
+    memset(output + got, 0, (want - got) * sizeof(float));
+    atomic_fetch_add_explicit(&ra->underruns, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ra->dry_frames, (want - got) / NUM_CHAN,
+      memory_order_relaxed);
+  }
+}
+
+void ahead_stop(RenderAhead *ra)
+{
+  /* Stops the worker; call after the stream is stopped. */
+  atomic_store(&ra->running, 0);
+  pthread_join(ra->thread, NULL);
+  fifo_free(&ra->fifo);
+}
@@ -0,0 +1,37 @@
+#ifndef _AHEAD_H_
+#define _AHEAD_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "synth.h"
+#include "melody.h"
+#include "loopcache.h"
+#include "fifo.h"
+#include "control.h"
+#include "rtUtils.h"
+
+#define AHEAD_MAX_BLOCKS  64   // furthest the worker may render ahead
+
+/* Render-ahead worker: renders into a FIFO that the callback drains */
+typedef struct {
+  Fifo fifo;
+  size_t target;               // samples to keep buffered
+  Control *ctl;                // control commands, or NULL
+  TrackPool *tp;               // extra tracks, or NULL
+  LoopCache *lc;
+  Synth *ps;
+  Melody *pm;
+  const RtConfig *rt;          // hardening for the worker, as for the callback
+  pthread_t thread;
+  atomic_int running;
+  atomic_long underruns;       // callbacks that found the FIFO short
+  atomic_long dry_frames;      // frames replaced by silence
+} RenderAhead;
+
+/* ahead.c function prototypes */
+int ahead_start(RenderAhead *ra, int blocks, Control *ctl, LoopCache *lc,
+  TrackPool *tp, Synth *ps, Melody *pm, const RtConfig *rt);
+void ahead_read(RenderAhead *ra, float *output, unsigned long frames);
+void ahead_stop(RenderAhead *ra);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * Offline render of one melody to a WAV file, split over all cores.
+ *
+ * The synth plays one note at a time and play_note() sets every field
+ * of the tone, so the audio from a note's first step on does not
+ * depend on anything before it. Each thread therefore takes an equal
+ * slice of the timeline, starts its synth at the last note on or
+ * before the slice (rendering that short preroll and throwing it
+ * away), and writes its slice straight into its place in the file.
+ * The result is the same, sample for sample, as rendering the whole
+ * thing from the start on one thread.
+ *
+ * Slices start on a chunk boundary and the dither restarts at every
+ * chunk from the chunk's number, so PCM output is the same too.
+ */
+
+#define _FILE_OFFSET_BITS 64 // for files past 2 GB
+#include <stdio.h>
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for memcmp()
+#include <time.h>    // for clock_gettime()
+#include <pthread.h>
+#include <unistd.h>  // for sysconf(), pread()
+#include "bounce.h"
+#include "render.h"
+#include "wav.h"
+#include "outfmt.h"
+
+/* One thread's slice of the render */
+typedef struct {
+  const Synth *ps;    // synth as it is at frame 0
+  const Melody *pm;
+  WavFile *wf;
+  int format, shape;  // output format, as in outfmt.h
+  long long start;    // first frame of the slice
+  long long end;      // one past the last frame
+  long long preroll;  // frames rendered before start and thrown away
+  int err;
+} BounceJob;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void seek_synth(Synth *s, const Melody *pm, long long frame,
+  long long *preroll)
+{
+  /* Puts the synth where rendering from frame 0 would leave it at the
+     last note on or before frame, and returns in preroll how far that
+     is behind frame. With no note before frame, the synth is still in
+     its starting state and only the step position needs setting. */
+  long long nd = pm->note_duration;
+  long long step = frame / nd, from = frame;
+
+  for (long long j = step; j >= 0 && j > step - NUM_COLS; j--) {
+    if (pm->freqs[j % NUM_COLS]) {
+      from = j * nd;
+      break;
+    }
+  }
+  s->index_count = (from / nd) % NUM_COLS;
+  s->samp_count = from % nd;
+  *preroll = frame - from;
+}
+
+static void *bounce_thread(void *arg)
+{
+  BounceJob *job = arg;
+  Synth s = *job->ps;
+  Melody m = *job->pm;
+  OutFmt of;
+  float *buf;
+  void *out;
+  long long pos = job->start, n;
+
+  outfmt_init(&of, job->format, job->shape);
+  buf = malloc(BOUNCE_CHUNK_FRAMES * NUM_CHAN * sizeof(float));
+  out = malloc(BOUNCE_CHUNK_FRAMES * NUM_CHAN * OUT_MAX_BYTES);
+  if (!buf || !out) {
+    free(buf);
+    free(out);
+    job->err = 1;
+    return NULL;
+  }
+
+  seek_synth(&s, &m, job->start, &job->preroll);
+  for (long long left = job->preroll; left > 0; left -= n) {
+    n = left < BOUNCE_CHUNK_FRAMES ? left : BOUNCE_CHUNK_FRAMES;
+    render_block(&s, &m, buf, n);
+  }
+
+  while (pos < job->end) {
+    n = job->end - pos;
+    if (n > BOUNCE_CHUNK_FRAMES)
+      n = BOUNCE_CHUNK_FRAMES;
+    render_block(&s, &m, buf, n);
+    outfmt_reset(&of, pos / BOUNCE_CHUNK_FRAMES);
+    outfmt_convert(&of, buf, out, n);
+    if (wav_pwrite(job->wf, out, pos, n) < 0) {
+      job->err = 1;
+      break;
+    }
+    pos += n;
+  }
+  free(buf);
+  free(out);
+  return NULL;
+}
+
+static int verify_serial(const Synth *ps, const Melody *pm, WavFile *wf,
+  int format, int shape)
+{
+  /* Renders the whole melody again on this thread, from the start,
+     and compares it with what the threads wrote. */
+  Synth s = *ps;
+  Melody m = *pm;
+  OutFmt of;
+  size_t bytes = BOUNCE_CHUNK_FRAMES * NUM_CHAN * OUT_MAX_BYTES;
+  float *buf = malloc(BOUNCE_CHUNK_FRAMES * NUM_CHAN * sizeof(float));
+  unsigned char *ref = malloc(bytes), *got = malloc(bytes);
+  int frame_bytes = NUM_CHAN * outfmt_bits(format) / 8;
+  long long pos = 0, n;
+  double t0 = now();
+  int ret = -1;
+
+  outfmt_init(&of, format, shape);
+  if (!buf || !ref || !got) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    goto done;
+  }
+  while (pos < wf->num_frames) {
+    n = wf->num_frames - pos;
+    if (n > BOUNCE_CHUNK_FRAMES)
+      n = BOUNCE_CHUNK_FRAMES;
+    render_block(&s, &m, buf, n);
+    outfmt_reset(&of, pos / BOUNCE_CHUNK_FRAMES);
+    bytes = outfmt_convert(&of, buf, ref, n);
+    if (pread(fileno(wf->fp), got, bytes,
+        wf->data_offset + pos * frame_bytes) != (ssize_t)bytes) {
+      fprintf(stderr, "ERROR: could not read back the output\n");
+      goto done;
+    }
+    if (memcmp(ref, got, bytes) != 0) {
+      for (size_t i = 0; i < bytes; i++) {
+        if (ref[i] != got[i]) {
+          fprintf(stderr, "verify: FAILED, first difference at frame %lld\n",
+            pos + (long long)(i / frame_bytes));
+          break;
+        }
+      }
+      goto done;
+    }
+    pos += n;
+  }
+  fprintf(stderr, "verify: identical to the serial render (%.2f s)\n",
+    now() - t0);
+  ret = 0;
+
+done:
+  free(buf);
+  free(ref);
+  free(got);
+  return ret;
+}
+
+int bounce_wav(Synth *ps, Melody *pm, const char *path, double seconds,
+  int format, int shape, int num_threads, int verify)
+{
+  /* Renders seconds of the melody (one full cycle if seconds is 0)
+     to a stereo WAV file in the given output format (outfmt.h),
+     dithered and optionally noise shaped, using num_threads threads
+     (0 for one per core). With verify, also renders it serially and
+     checks the two are bit-identical. Returns 0, or -1 on error. */
+  WavFile wf;
+  BounceJob *jobs;
+  pthread_t *threads;
+  long long num_frames, per, preroll = 0;
+  double t0;
+  int err = 0, started;
+
+  if (pm->note_duration <= 0) {
+    fprintf(stderr, "ERROR: melody has no tempo\n");
+    return -1;
+  }
+  if (seconds > 0)
+    num_frames = (long long)(seconds * ps->samp_rate);
+  else
+    num_frames = (long long)NUM_COLS * pm->note_duration;
+
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads <= 0)
+    num_threads = 1;
+  // No point in slices shorter than one write
+  if (num_threads > num_frames / BOUNCE_CHUNK_FRAMES)
+    num_threads = num_frames / BOUNCE_CHUNK_FRAMES > 0 ?
+      num_frames / BOUNCE_CHUNK_FRAMES : 1;
+  // Slices of whole chunks; rounding up may leave a thread spare
+  per = (num_frames + num_threads - 1) / num_threads;
+  per = (per + BOUNCE_CHUNK_FRAMES - 1) / BOUNCE_CHUNK_FRAMES *
+    BOUNCE_CHUNK_FRAMES;
+  num_threads = num_frames > 0 ? (num_frames + per - 1) / per : 1;
+
+  if (wav_create(&wf, path, ps->samp_rate, NUM_CHAN, outfmt_bits(format),
+      outfmt_wav_format(format), num_frames) < 0)
+    return -1;
+
+  jobs = calloc(num_threads, sizeof(BounceJob));
+  threads = calloc(num_threads, sizeof(pthread_t));
+  if (!jobs || !threads) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    free(jobs);
+    free(threads);
+    wav_close(&wf);
+    return -1;
+  }
+
+  /* Each thread renders an equal slice straight into the file */
+  t0 = now();
+  for (started = 0; started < num_threads; started++) {
+    int i = started;
+    jobs[i].ps = ps;
+    jobs[i].pm = pm;
+    jobs[i].wf = &wf;
+    jobs[i].format = format;
+    jobs[i].shape = shape;
+    jobs[i].start = i * per;
+    jobs[i].end = (i + 1) * per < num_frames ? (i + 1) * per : num_frames;
+    if (pthread_create(&threads[i], NULL, bounce_thread, &jobs[i]) != 0) {
+      fprintf(stderr, "ERROR: could not start thread %d of %d\n", i + 1,
+        num_threads);
+      err = 1;
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    err |= jobs[i].err;
+    preroll += jobs[i].preroll;
+  }
+  if (err)
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+  else
+    fprintf(stderr, "%s: %.1f s of audio in %.2f s on %d threads "
+      "(%.2f s preroll)\n", path, (double)num_frames / ps->samp_rate,
+      now() - t0, num_threads, (double)preroll / ps->samp_rate);
+
+  if (!err && verify)
+    err = verify_serial(ps, pm, &wf, format, shape) < 0;
+
+  free(jobs);
+  free(threads);
+  if (wav_close(&wf) < 0 && !err) {
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+    err = 1;
+  }
+  return err ? -1 : 0;
+}
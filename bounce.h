@@ -0,0 +1,13 @@
+#ifndef _BOUNCE_H_
+#define _BOUNCE_H_
+
+#include "synth.h"
+#include "melody.h"
+
+#define BOUNCE_CHUNK_FRAMES  (FRAMES_PER_BUFFER*16) // frames per write
+
+/* bounce.c function prototypes */
+int bounce_wav(Synth *ps, Melody *pm, const char *path, double seconds,
+  int format, int shape, int num_threads, int verify);
+
+#endif
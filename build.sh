@@ -1,4 +1,7 @@
 #!/bin/sh
-gcc -w -o pentaseq main.c synth.c melody.c paUtils.c \
+gcc -w -o pentaseq main.c synth.c melody.c paUtils.c render.c stream.c rtUtils.c \
+	wav.c fft.c transcribe.c loopcache.c \
+	fifo.c ahead.c control.c tracks.c meter.c bounce.c sampler.c shmring.c loadtest.c outfmt.c record.c \
 	-I/usr/local/include \
-	-L/usr/local/lib -lportaudio -lncurses
+	-L/usr/local/lib -lportaudio -lncurses -lm -lpthread
+gcc -w -o shmreader shmreader.c shmring.c
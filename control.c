@@ -0,0 +1,367 @@
+/*
+ * Control server: OSC over UDP on 127.0.0.1.
+ *
+ *   /pentaseq/melody    s  melody file to load and play
+ *   /pentaseq/tempo     i  tempo in BPM (15 to 999)
+ *   /pentaseq/transpose i  semitones up (or down, if negative)
+ *   /pentaseq/mute      i  1 = mute, 0 = unmute
+ *   /pentaseq/record    i  1 = record, 0 = stop
+ *
+ * Numbers may be sent as int32 or float32. A plain message applies at
+ * the next step boundary. Messages in a bundle apply at the frame
+ * expected to be heard at the bundle's time tag, or at the next block
+ * for "immediately". That frame comes from the render position, the
+ * clock and the latency the device reports, so it is as exact as the
+ * device's report and its callback timing.
+ *
+ * Packets are parsed and melody files are read on the server thread.
+ * The render thread only drains a lock-free queue of ready-made
+ * commands and applies each one at its frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>      // for atoi()
+#include <string.h>      // for memcmp()
+#include <math.h>        // for pow()
+#include <time.h>        // for clock_gettime()
+#include <unistd.h>      // for close()
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>   // for htonl()
+#include "control.h"
+#include "render.h"
+
+#define NTP_UNIX_OFFSET  2208988800ULL // seconds from 1900 to 1970
+
+static unsigned int get_be32(const unsigned char *p)
+{
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static const char *osc_string(const unsigned char **p, const unsigned char *end)
+{
+  /* Returns the NUL-terminated string at *p and skips its padding,
+     or NULL if it runs past the end of the packet. */
+  const char *s = (const char *)*p;
+  size_t len, padded;
+
+  if (*p >= end)
+    return NULL;
+  len = strnlen(s, end - *p);
+  padded = (len + 4) & ~3;
+  if (len >= (size_t)(end - *p) || padded > (size_t)(end - *p))
+    return NULL;
+  *p += padded;
+  return s;
+}
+
+static int push(Control *ctl, Command *cmd)
+{
+  /* Server thread: queue a command for the render thread. */
+  unsigned int head = atomic_load_explicit(&ctl->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ctl->tail, memory_order_acquire);
+
+  if (head - tail >= CTL_QUEUE_LEN) {
+    atomic_fetch_add(&ctl->dropped, 1);
+    return -1;
+  }
+  ctl->queue[head & (CTL_QUEUE_LEN - 1)] = *cmd;
+  atomic_store_explicit(&ctl->head, head + 1, memory_order_release);
+  return 0;
+}
+
+static void handle_message(Control *ctl, const unsigned char *p, int len,
+  int when, long long time_ns)
+{
+  /* Turns one OSC message into a command. */
+  const unsigned char *end = p + len;
+  const char *addr, *tags, *str = NULL;
+  double num = 0;
+  int have_num = 0;
+  Command cmd;
+  unsigned int bits;
+  float f;
+
+  if (!(addr = osc_string(&p, end)) || !(tags = osc_string(&p, end)) ||
+      tags[0] != ',')
+    return;
+
+  // Only the first argument is used
+  if (tags[1] == 'i' && p + 4 <= end) {
+    num = (int)get_be32(p);
+    have_num = 1;
+  } else if (tags[1] == 'f' && p + 4 <= end) {
+    bits = get_be32(p);
+    memcpy(&f, &bits, 4);
+    num = f;
+    have_num = 1;
+  } else if (tags[1] == 's') {
+    str = osc_string(&p, end);
+  }
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.when = when;
+  cmd.time_ns = time_ns;
+
+  if (strcmp(addr, "/pentaseq/melody") == 0 && str) {
+    cmd.type = CMD_MELODY;
+    cmd.melody.filename = str;
+    // Only a file that parses cleanly is queued
+    if (read_melody(&cmd.melody) < 0)
+      return;
+    make_freqs(&cmd.melody);
+    cmd.melody.filename = NULL;
+    if (push(ctl, &cmd) == 0)
+      // Have its cycle cached once it has played
+      loop_cache_select(ctl->lc, &ctl->model, &cmd.melody);
+  } else if (strcmp(addr, "/pentaseq/tempo") == 0 && have_num &&
+      num >= TEMPO_MIN) {
+    cmd.type = CMD_TEMPO;
+    // Clamp before converting: a huge float would overflow the int
+    cmd.value = num > TEMPO_MAX ? TEMPO_MAX : (int)num;
+    if (push(ctl, &cmd) == 0)
+      // Same formula as read_melody(); cache the melody at the new tempo
+      loop_cache_retune(ctl->lc, &ctl->model, SAMP_RATE/((cmd.value*4)/60));
+  } else if (strcmp(addr, "/pentaseq/transpose") == 0 && have_num) {
+    cmd.type = CMD_TRANSPOSE;
+    cmd.ratio = pow(2.0, num/12.0);
+    if (push(ctl, &cmd) == 0) {
+      ctl->model.pitch_ratio = cmd.ratio;
+      loop_cache_retune(ctl->lc, &ctl->model, 0);
+    }
+  } else if (strcmp(addr, "/pentaseq/mute") == 0 && have_num) {
+    cmd.type = CMD_MUTE;
+    cmd.value = num != 0;
+    push(ctl, &cmd);
+  } else if (strcmp(addr, "/pentaseq/record") == 0 && have_num) {
+    cmd.type = CMD_RECORD;
+    cmd.value = num != 0;
+    push(ctl, &cmd);
+  }
+}
+
+static void handle_packet(Control *ctl, const unsigned char *p, int len,
+  int when, long long time_ns)
+{
+  /* Handles a message or a (possibly nested) bundle. */
+  unsigned long long tag;
+  int size;
+
+  if (len >= 16 && memcmp(p, "#bundle", 8) == 0) {
+    tag = ((unsigned long long)get_be32(p+8) << 32) | get_be32(p+12);
+    if (tag == 1) {
+      when = AT_NOW;
+    } else {
+      when = AT_TIME;
+      time_ns = (long long)((tag >> 32) - NTP_UNIX_OFFSET) * 1000000000LL +
+        (long long)(((tag & 0xffffffffULL) * 1000000000ULL) >> 32);
+    }
+    p += 16;
+    len -= 16;
+    while (len >= 4) {
+      size = get_be32(p);
+      p += 4;
+      len -= 4;
+      if (size < 0 || size > len)
+        break;
+      handle_packet(ctl, p, size, when, time_ns);
+      p += size;
+      len -= size;
+    }
+  } else if (len > 0 && p[0] == '/') {
+    handle_message(ctl, p, len, when, time_ns);
+  }
+}
+
+static void *control_server(void *arg)
+{
+  /* Receives packets until stopped. The socket times out
+     periodically so the running flag gets checked. */
+  Control *ctl = arg;
+  unsigned char packet[CTL_PACKET_MAX];
+  ssize_t n;
+
+  while (atomic_load(&ctl->running)) {
+    n = recv(ctl->sock, packet, sizeof(packet), 0);
+    if (n > 0)
+      handle_packet(ctl, packet, n, AT_STEP, 0);
+  }
+  return NULL;
+}
+
+int control_start(Control *ctl, int port, LoopCache *lc, const Synth *ps,
+  int *wav_out, long long latency)
+{
+  /* Opens the UDP socket on 127.0.0.1 and starts the server thread. */
+  struct sockaddr_in addr;
+  struct timeval tv = {0, 200000};
+
+  memset(ctl, 0, sizeof(*ctl));
+  ctl->lc = lc;
+  ctl->wav_out = wav_out;
+  atomic_init(&ctl->latency, latency);
+  // Same instrument as the synth the commands are for
+  ctl->model.samp_rate = ps->samp_rate;
+  ctl->model.pitch_ratio = ps->pitch_ratio;
+  ctl->model.samples = ps->samples;
+  ctl->model.interp = ps->interp;
+  atomic_init(&ctl->head, 0);
+  atomic_init(&ctl->tail, 0);
+  atomic_init(&ctl->dropped, 0);
+  atomic_init(&ctl->running, 1);
+
+  ctl->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (ctl->sock < 0) {
+    fprintf(stderr, "ERROR: could not create control socket\n");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(ctl->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "ERROR: could not bind control port %d\n", port);
+    close(ctl->sock);
+    return -1;
+  }
+  setsockopt(ctl->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  if (pthread_create(&ctl->thread, NULL, control_server, ctl) != 0) {
+    fprintf(stderr, "ERROR: could not start control thread\n");
+    close(ctl->sock);
+    return -1;
+  }
+  return 0;
+}
+
+static void drain(Control *ctl, Synth *ps, Melody *pm)
+{
+  /* Render thread: moves queued commands into the pending list,
+     working out the frame each one is due at. */
+  unsigned int tail = atomic_load_explicit(&ctl->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ctl->head, memory_order_acquire);
+  struct timespec now;
+  long long now_ns = -1;
+  Command *c;
+  int i;
+
+  for (; tail != head && ctl->num_pending < CTL_PENDING_MAX; tail++) {
+    c = &ctl->queue[tail & (CTL_QUEUE_LEN - 1)];
+    switch (c->when) {
+      case AT_STEP:
+        c->due = ctl->frame;
+        if (ps->samp_count > 0 && ps->samp_count < pm->note_duration)
+          c->due += pm->note_duration - ps->samp_count;
+        break;
+      case AT_TIME:
+        if (now_ns < 0) {
+          clock_gettime(CLOCK_REALTIME, &now);
+          now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+        }
+        // Frame that will be heard at the time tag
+        c->due = ctl->frame - atomic_load_explicit(&ctl->latency,
+          memory_order_relaxed) +
+          (c->time_ns - now_ns) * ps->samp_rate / 1000000000LL;
+        if (c->due < ctl->frame)
+          c->due = ctl->frame;
+        break;
+      default:
+        c->due = ctl->frame;
+        break;
+    }
+
+    // Insert in due order, after commands due at the same frame
+    for (i = ctl->num_pending; i > 0 && ctl->pending[i-1].due > c->due; i--)
+      ctl->pending[i] = ctl->pending[i-1];
+    ctl->pending[i] = *c;
+    ctl->num_pending++;
+  }
+  atomic_store_explicit(&ctl->tail, tail, memory_order_release);
+}
+
+static void apply(Control *ctl, Command *c, Synth *ps, Melody *pm)
+{
+  /* Render thread: applies one command. */
+  switch (c->type) {
+    case CMD_MELODY:
+      pm->tempo = c->melody.tempo;
+      pm->scale = c->melody.scale;
+      pm->start_note = c->melody.start_note;
+      memcpy(pm->notes, c->melody.notes, sizeof(pm->notes));
+      memcpy(pm->freqs, c->melody.freqs, sizeof(pm->freqs));
+      pm->note_duration = c->melody.note_duration;
+      break;
+    case CMD_TEMPO:
+      // Same formula as read_melody()
+      pm->tempo = c->value;
+      pm->note_duration = SAMP_RATE/((pm->tempo*4)/60);
+      break;
+    case CMD_TRANSPOSE:
+      ps->pitch_ratio = c->ratio;
+      break;
+    case CMD_MUTE:
+      ctl->muted = c->value;
+      break;
+    case CMD_RECORD:
+      if (ctl->wav_out)
+        *ctl->wav_out = c->value;
+      break;
+  }
+}
+
+void control_set_latency(Control *ctl, long long latency)
+{
+  /* Sets the frames between rendering and being heard, once the
+     device has said what its output latency really is. */
+  atomic_store_explicit(&ctl->latency, latency, memory_order_relaxed);
+}
+
+void control_render(Control *ctl, LoopCache *lc, TrackPool *tp,
+  Synth *ps, Melody *pm, float *output, unsigned long frames)
+{
+  /* Renders the main melody through the loop cache and mixes in the
+     extra tracks, splitting the block wherever a command is due so it
+     applies at exactly that frame. */
+  unsigned long n;
+  long long wait;
+
+  if (!ctl) {
+    loop_cache_render(lc, ps, pm, output, frames);
+    tracks_render(tp, output, frames);
+    return;
+  }
+
+  drain(ctl, ps, pm);
+  while (frames > 0) {
+    n = frames;
+    if (ctl->num_pending) {
+      wait = ctl->pending[0].due - ctl->frame;
+      if (wait <= 0) {
+        apply(ctl, &ctl->pending[0], ps, pm);
+        ctl->num_pending--;
+        memmove(ctl->pending, ctl->pending + 1,
+          ctl->num_pending * sizeof(Command));
+        continue;
+      }
+      if (wait < (long long)n)
+        n = wait;
+    }
+
+    loop_cache_render(lc, ps, pm, output, n);
+    tracks_render(tp, output, n);
+    if (ctl->muted)
+      memset(output, 0, n * NUM_CHAN * sizeof(float));
+
+    ctl->frame += n;
+    output += n * NUM_CHAN;
+    frames -= n;
+  }
+}
+
+void control_stop(Control *ctl)
+{
+  /* Stops the server thread and closes the socket. */
+  atomic_store(&ctl->running, 0);
+  pthread_join(ctl->thread, NULL);
+  close(ctl->sock);
+}
@@ -0,0 +1,71 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "synth.h"
+#include "melody.h"
+#include "loopcache.h"
+#include "tracks.h"
+
+#define CTL_DEFAULT_PORT  9000 // UDP port on 127.0.0.1
+#define CTL_QUEUE_LEN     64   // commands in flight (power of two)
+#define CTL_PENDING_MAX   64   // commands waiting for their time
+#define CTL_PACKET_MAX    1536 // largest OSC packet accepted
+
+/* Command types */
+#define CMD_MELODY      1   // replace the melody
+#define CMD_TEMPO       2   // set tempo (BPM)
+#define CMD_TRANSPOSE   3   // set transposition (pitch ratio)
+#define CMD_MUTE        4   // mute (1) or unmute (0)
+#define CMD_RECORD      5   // start (1) or stop (0) recording
+
+/* When a command applies */
+#define AT_STEP         0   // next step boundary
+#define AT_TIME         1   // wall-clock time (OSC time tag)
+#define AT_NOW          2   // start of the next rendered block
+
+/* A command, fully prepared off the audio thread */
+typedef struct {
+  int type;
+  int when;                // AT_STEP, AT_TIME or AT_NOW
+  long long time_ns;       // CLOCK_REALTIME for AT_TIME
+  long long due;           // engine frame, set by the render thread
+  int value;               // tempo, mute or record flag
+  double ratio;            // transposition
+  Melody melody;           // new melody for CMD_MELODY
+} Command;
+
+/* Control server and the engine state it drives */
+typedef struct {
+  /* Lock-free single-producer, single-consumer command queue */
+  Command queue[CTL_QUEUE_LEN];
+  _Alignas(64) atomic_uint head;  // written by the server thread
+  _Alignas(64) atomic_uint tail;  // read by the render thread
+
+  /* Render thread state */
+  Command pending[CTL_PENDING_MAX]; // drained commands, sorted by due
+  int num_pending;
+  long long frame;         // frames rendered so far
+  atomic_llong latency;    // frames between rendering and playback
+  int muted;
+  int *wav_out;            // recording flag the record command sets
+
+  /* Server thread state */
+  int sock;
+  LoopCache *lc;
+  Synth model;             // synth settings as the commands leave them
+  pthread_t thread;
+  atomic_int running;
+  atomic_long dropped;     // commands lost to a full queue
+} Control;
+
+/* control.c function prototypes */
+int control_start(Control *ctl, int port, LoopCache *lc, const Synth *ps,
+  int *wav_out, long long latency);
+void control_set_latency(Control *ctl, long long latency);
+void control_render(Control *ctl, LoopCache *lc, TrackPool *tp,
+  Synth *ps, Melody *pm, float *output, unsigned long frames);
+void control_stop(Control *ctl);
+
+#endif
@@ -0,0 +1,44 @@
+#include <math.h> // for sin(), cos()
+#include "fft.h"
+#include "synth.h"
+
+void fft(float *re, float *im, int n)
+{
+  /* In-place radix-2 complex FFT. n must be a power of two. */
+  int i, j, k, len;
+  float tr, ti;
+
+  /* Bit-reversal permutation */
+  for (i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      tr = re[i]; re[i] = re[j]; re[j] = tr;
+      ti = im[i]; im[i] = im[j]; im[j] = ti;
+    }
+  }
+
+  /* Butterflies */
+  for (len = 2; len <= n; len <<= 1) {
+    double ang = -2*PI/len;
+    double wr = cos(ang), wi = sin(ang);
+    for (i = 0; i < n; i += len) {
+      double cr = 1, ci = 0, t;
+      for (k = 0; k < len/2; k++) {
+        int a = i + k, b = i + k + len/2;
+        tr = re[b]*cr - im[b]*ci;
+        ti = re[b]*ci + im[b]*cr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+        // Advance the twiddle factor
+        t = cr*wr - ci*wi;
+        ci = cr*wi + ci*wr;
+        cr = t;
+      }
+    }
+  }
+}
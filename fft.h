@@ -0,0 +1,7 @@
+#ifndef _FFT_H_
+#define _FFT_H_
+
+/* fft.c function prototypes */
+void fft(float *re, float *im, int n);
+
+#endif
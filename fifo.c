@@ -0,0 +1,67 @@
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for memcpy()
+#include "fifo.h"
+
+int fifo_init(Fifo *f, size_t min_samples)
+{
+  /* Allocates a ring of at least min_samples samples. */
+  size_t size = 1;
+
+  while (size < min_samples)
+    size <<= 1;
+  f->buf = calloc(size, sizeof(float));
+  if (!f->buf)
+    return -1;
+  f->size = size;
+  atomic_init(&f->head, 0);
+  atomic_init(&f->tail, 0);
+  return 0;
+}
+
+size_t fifo_avail(Fifo *f)
+{
+  /* Samples ready to read. */
+  return atomic_load_explicit(&f->head, memory_order_acquire) -
+    atomic_load_explicit(&f->tail, memory_order_acquire);
+}
+
+size_t fifo_write(Fifo *f, const float *data, size_t n)
+{
+  /* Producer: copies in as many of n samples as fit. */
+  size_t head = atomic_load_explicit(&f->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&f->tail, memory_order_acquire);
+  size_t space = f->size - (head - tail);
+  size_t pos = head & (f->size - 1), first;
+
+  if (n > space)
+    n = space;
+  // Copy in up to two pieces around the end of the ring
+  first = f->size - pos < n ? f->size - pos : n;
+  memcpy(f->buf + pos, data, first * sizeof(float));
+  memcpy(f->buf, data + first, (n - first) * sizeof(float));
+  atomic_store_explicit(&f->head, head + n, memory_order_release);
+  return n;
+}
+
+size_t fifo_read(Fifo *f, float *data, size_t n)
+{
+  /* Consumer: copies out up to n samples. */
+  size_t tail = atomic_load_explicit(&f->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&f->head, memory_order_acquire);
+  size_t avail = head - tail;
+  size_t pos = tail & (f->size - 1), first;
+
+  if (n > avail)
+    n = avail;
+  first = f->size - pos < n ? f->size - pos : n;
+  memcpy(data, f->buf + pos, first * sizeof(float));
+  memcpy(data + first, f->buf, (n - first) * sizeof(float));
+  atomic_store_explicit(&f->tail, tail + n, memory_order_release);
+  return n;
+}
+
+void fifo_free(Fifo *f)
+{
+  free(f->buf);
+  f->buf = NULL;
+}
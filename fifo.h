@@ -0,0 +1,23 @@
+#ifndef _FIFO_H_
+#define _FIFO_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Lock-free single-producer, single-consumer ring of samples.
+   One thread only writes and one thread only reads. */
+typedef struct {
+  float *buf;
+  size_t size;                   // capacity in samples (power of two)
+  _Alignas(64) atomic_size_t head; // total samples written (producer)
+  _Alignas(64) atomic_size_t tail; // total samples read (consumer)
+} Fifo;
+
+/* fifo.c function prototypes */
+int fifo_init(Fifo *f, size_t min_samples);
+size_t fifo_avail(Fifo *f);
+size_t fifo_write(Fifo *f, const float *data, size_t n);
+size_t fifo_read(Fifo *f, float *data, size_t n);
+void fifo_free(Fifo *f);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Load test: how many tracks can this machine render at this buffer
+ * size? The real audio callback runs, against the sound card or a
+ * null sink that takes a buffer every FRAMES_PER_BUFFER/SAMP_RATE,
+ * and times itself. The test adds tracks step by step, narrows down
+ * the first count the callback can't keep up with, and reports the
+ * largest count that kept up and the largest that kept LOAD_MARGIN
+ * percent of the deadline spare.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for memset()
+#include <time.h>    // for clock_nanosleep()
+#include <unistd.h>  // for usleep()
+#include "loadtest.h"
+
+#define LOAD_WARMUP_US  200000 // settling time after changing tracks
+
+/* Track counts tried, until one fails */
+static const int ramp[] = {0, 1, 2, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96,
+  128, 192, 256, 384, 512, 768, 1024};
+
+/* One step of the test */
+typedef struct {
+  int tracks;
+  unsigned long long blocks, xruns;
+  double cpu, p99, peak;           // percent of the deadline
+  int ok;                          // no xruns and peak under 100%
+} LoadRow;
+
+void load_init(LoadStats *ls)
+{
+  memset(ls, 0, sizeof(*ls));
+  ls->deadline_ns = 1000000000LL * FRAMES_PER_BUFFER / SAMP_RATE;
+}
+
+void load_record(LoadStats *ls, long long ns, int underflow)
+{
+  /* Audio thread: counts one callback that took ns. */
+  unsigned long long max = atomic_load_explicit(&ls->max_ns,
+    memory_order_relaxed);
+  long long b = ns * (LOAD_BUCKETS / 2) / ls->deadline_ns;
+
+  atomic_fetch_add_explicit(&ls->blocks, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&ls->busy_ns, ns, memory_order_relaxed);
+  while ((unsigned long long)ns > max &&
+    !atomic_compare_exchange_weak(&ls->max_ns, &max, ns))
+    ;
+  if (ns > ls->deadline_ns || underflow)
+    atomic_fetch_add_explicit(&ls->xruns, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&ls->hist[b < LOAD_BUCKETS ? b : LOAD_BUCKETS],
+    1, memory_order_relaxed);
+}
+
+static void *null_sink_thread(void *arg)
+{
+  /* Calls the callback once per buffer period, like a device would.
+     A callback that runs late pushes the clock back rather than
+     being followed by a burst of catch-up calls. */
+  NullSink *sink = arg;
+  PaStreamCallbackTimeInfo ti;
+  struct timespec next, now;
+  float *buf = calloc(FRAMES_PER_BUFFER * NUM_CHAN, sizeof(float));
+  long long period = sink->stats->deadline_ns;
+
+  if (!buf)
+    return NULL;
+  memset(&ti, 0, sizeof(ti));
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (atomic_load(&sink->running)) {
+    sink->callback(NULL, buf, FRAMES_PER_BUFFER, &ti, 0, sink->data);
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > next.tv_sec ||
+        (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+      next = now;
+    else
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  free(buf);
+  return NULL;
+}
+
+int null_sink_start(NullSink *sink, PaStreamCallback *callback, void *data,
+  LoadStats *ls)
+{
+  sink->callback = callback;
+  sink->data = data;
+  sink->stats = ls;
+  atomic_init(&sink->running, 1);
+  if (pthread_create(&sink->thread, NULL, null_sink_thread, sink) != 0) {
+    fprintf(stderr, "ERROR: could not start the null sink\n");
+    return -1;
+  }
+  return 0;
+}
+
+void null_sink_stop(NullSink *sink)
+{
+  atomic_store(&sink->running, 0);
+  pthread_join(sink->thread, NULL);
+}
+
+static void run_step(LoadStats *ls, TrackPool *tp, Melody *pm, int tracks,
+  double seconds, LoadRow *row)
+{
+  /* Plays tracks extra tracks for seconds and measures the callback. */
+  unsigned long long blocks, busy, xruns, hist[LOAD_BUCKETS + 1];
+  unsigned long long count, n99;
+  int i;
+
+  tracks_clear(tp);
+  for (i = 0; i < tracks; i++)
+    tracks_add(tp, pm);
+  usleep(LOAD_WARMUP_US);
+
+  blocks = atomic_load(&ls->blocks);
+  busy = atomic_load(&ls->busy_ns);
+  xruns = atomic_load(&ls->xruns);
+  for (i = 0; i <= LOAD_BUCKETS; i++)
+    hist[i] = atomic_load(&ls->hist[i]);
+  atomic_store(&ls->max_ns, 0);
+
+  usleep((useconds_t)(seconds * 1e6));
+
+  row->tracks = tracks;
+  row->blocks = atomic_load(&ls->blocks) - blocks;
+  row->xruns = atomic_load(&ls->xruns) - xruns;
+  busy = atomic_load(&ls->busy_ns) - busy;
+  row->peak = 100.0 * atomic_load(&ls->max_ns) / ls->deadline_ns;
+  row->cpu = row->blocks ?
+    100.0 * busy / ((double)row->blocks * ls->deadline_ns) : 0;
+
+  // 99th percentile from the histogram, rounded up to the bucket's top
+  n99 = row->blocks - row->blocks / 100;
+  count = 0;
+  row->p99 = 0;
+  for (i = 0; i <= LOAD_BUCKETS; i++) {
+    count += atomic_load(&ls->hist[i]) - hist[i];
+    if (count >= n99 && row->blocks) {
+      row->p99 = 200.0 * (i + 1) / LOAD_BUCKETS;
+      break;
+    }
+  }
+  row->ok = row->blocks > 0 && row->xruns == 0 && row->peak < 100;
+
+  fprintf(stderr, "%6d %7llu %6.1f %6.1f %6.1f %6llu  %s\n", row->tracks,
+    row->blocks, row->cpu, row->p99, row->peak, row->xruns,
+    !row->ok ? "FAIL" : row->peak > 100 - LOAD_MARGIN ? "tight" : "ok");
+}
+
+int load_test(LoadStats *ls, TrackPool *tp, Melody *pm, const char *sink,
+  double step_seconds, FILE *json)
+{
+  /* Ramps the number of tracks until the callback can't keep up,
+     then narrows down the limit. Prints a table on stderr and the
+     results as JSON. Returns the largest count that kept up. */
+  LoadRow rows[64];
+  int num_rows = 0, lo = -1, hi = -1, max_ok = -1, safe = -1, tight = -1, i;
+  double cycle = (double)NUM_COLS * pm->note_duration / SAMP_RATE;
+
+  // Long enough to hear the whole melody, so every step is the same mix
+  if (step_seconds < cycle)
+    step_seconds = cycle;
+  if (step_seconds < LOAD_MIN_STEP)
+    step_seconds = LOAD_MIN_STEP;
+
+  fprintf(stderr, "load test: %s sink, %d frames at %d Hz (%.2f ms), "
+    "%d workers, %.1f s per step\n", sink, FRAMES_PER_BUFFER, SAMP_RATE,
+    ls->deadline_ns / 1e6, tp->num_workers, step_seconds);
+  fprintf(stderr, "%6s %7s %6s %6s %6s %6s\n", "tracks", "blocks", "cpu%",
+    "p99%", "peak%", "xruns");
+
+  /* Ramp up */
+  for (i = 0; i < (int)(sizeof(ramp) / sizeof(ramp[0])) &&
+      ramp[i] <= MAX_TRACKS; i++) {
+    run_step(ls, tp, pm, ramp[i], step_seconds, &rows[num_rows]);
+    if (!rows[num_rows++].ok) {
+      hi = ramp[i];
+      break;
+    }
+    lo = ramp[i];
+  }
+
+  /* Narrow down to within about 1/16 between the last pass and fail */
+  while (hi > 0 && lo >= 0 && hi - lo > 1 && hi - lo > lo / 16 &&
+      num_rows < (int)(sizeof(rows) / sizeof(rows[0]))) {
+    int mid = (lo + hi) / 2;
+    run_step(ls, tp, pm, mid, step_seconds, &rows[num_rows]);
+    if (rows[num_rows++].ok)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  tracks_clear(tp);
+
+  /* Safe: below the fewest tracks that failed or ate into the margin */
+  for (i = 0; i < num_rows; i++)
+    if ((!rows[i].ok || rows[i].peak > 100 - LOAD_MARGIN) &&
+        (tight < 0 || rows[i].tracks < tight))
+      tight = rows[i].tracks;
+  for (i = 0; i < num_rows; i++) {
+    if (rows[i].ok && rows[i].tracks > max_ok)
+      max_ok = rows[i].tracks;
+    if (rows[i].ok && (tight < 0 || rows[i].tracks < tight) &&
+        rows[i].tracks > safe)
+      safe = rows[i].tracks;
+  }
+  if (max_ok < 0)
+    fprintf(stderr, "the callback can't keep up even with no extra tracks\n");
+  else
+    fprintf(stderr, "kept up with %d%s tracks; with %d%% spare: %d\n",
+      max_ok, hi < 0 ? "+" : "", LOAD_MARGIN, safe);
+
+  /* Same results for scripts */
+  fprintf(json, "{\n  \"sink\": \"%s\",\n  \"samp_rate\": %d,\n"
+    "  \"frames_per_buffer\": %d,\n  \"deadline_ms\": %.3f,\n"
+    "  \"workers\": %d,\n  \"margin_pct\": %d,\n  \"steps\": [\n",
+    sink, SAMP_RATE, FRAMES_PER_BUFFER, ls->deadline_ns / 1e6,
+    tp->num_workers, LOAD_MARGIN);
+  for (i = 0; i < num_rows; i++)
+    fprintf(json, "    {\"tracks\": %d, \"blocks\": %llu, \"cpu_pct\": %.1f, "
+      "\"p99_pct\": %.1f, \"peak_pct\": %.1f, \"xruns\": %llu, "
+      "\"ok\": %s}%s\n", rows[i].tracks, rows[i].blocks, rows[i].cpu,
+      rows[i].p99, rows[i].peak, rows[i].xruns, rows[i].ok ? "true" : "false",
+      i + 1 < num_rows ? "," : "");
+  fprintf(json, "  ],\n  \"max_tracks\": %d,\n  \"limit_reached\": %s,\n"
+    "  \"safe_tracks\": %d\n}\n", max_ok, hi >= 0 ? "true" : "false", safe);
+  fflush(json);
+  return max_ok;
+}
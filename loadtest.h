@@ -0,0 +1,44 @@
+#ifndef _LOADTEST_H_
+#define _LOADTEST_H_
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <portaudio.h>
+#include "synth.h"
+#include "melody.h"
+#include "tracks.h"
+
+#define LOAD_MARGIN       25  // percent of the deadline kept spare
+#define LOAD_BUCKETS      100 // histogram buckets, 2% of the deadline each
+#define LOAD_MIN_STEP     1.0 // shortest time at each track count (seconds)
+
+/* Callback timings, written by the audio thread */
+typedef struct {
+  long long deadline_ns;         // FRAMES_PER_BUFFER/SAMP_RATE
+  atomic_ullong blocks;          // callbacks timed
+  atomic_ullong busy_ns;         // time spent in them
+  atomic_ullong max_ns;          // slowest since the last reset
+  atomic_ullong xruns;           // late callbacks and device underflows
+  atomic_uint hist[LOAD_BUCKETS + 1]; // by time, the last is >= 200%
+} LoadStats;
+
+/* A simulated device that consumes a buffer every deadline */
+typedef struct {
+  PaStreamCallback *callback;
+  void *data;
+  LoadStats *stats;
+  pthread_t thread;
+  atomic_int running;
+} NullSink;
+
+/* loadtest.c function prototypes */
+void load_init(LoadStats *ls);
+void load_record(LoadStats *ls, long long ns, int underflow);
+int null_sink_start(NullSink *sink, PaStreamCallback *callback, void *data,
+  LoadStats *ls);
+void null_sink_stop(NullSink *sink);
+int load_test(LoadStats *ls, TrackPool *tp, Melody *pm, const char *sink,
+  double step_seconds, FILE *json);
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * Loop cache: a melody loops over the same NUM_COLS steps forever and
+ * play_note() resets the tone, so once a full cycle has played every
+ * later cycle is sample-for-sample the same. The audio thread records
+ * one such steady-state cycle while it renders it, and from then on
+ * copies the cycle out instead of synthesizing it.
+ *
+ * Entries are created and evicted only in loop_cache_select(), called
+ * from the UI or control thread under a mutex. The audio thread only reads the entry it has
+ * acknowledged through `active`, and the UI thread never frees that one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for memcpy()
+#include <unistd.h>  // for usleep()
+#include "loopcache.h"
+#include "render.h"
+
+static int matches(LoopEntry *e, Synth *ps, Melody *pm)
+{
+  /* Does the entry hold this melody as this synth plays it? */
+  return e && e->note_duration == pm->note_duration &&
+    e->samp_rate == ps->samp_rate && e->pitch_ratio == ps->pitch_ratio &&
+    e->samples == ps->samples && e->interp == ps->interp &&
+    memcmp(e->freqs, pm->freqs, sizeof(e->freqs)) == 0;
+}
+
+void loop_cache_init(LoopCache *lc, size_t budget, int threaded)
+{
+  memset(lc, 0, sizeof(*lc));
+  lc->budget = budget;
+  lc->threaded = threaded;
+  pthread_mutex_init(&lc->lock, NULL);
+  atomic_init(&lc->pending, NULL);
+  atomic_init(&lc->active, NULL);
+  atomic_init(&lc->hits, 0);
+  atomic_init(&lc->misses, 0);
+}
+
+static void unlink_entry(LoopCache *lc, LoopEntry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    lc->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void push_front(LoopCache *lc, LoopEntry *e)
+{
+  e->prev = NULL;
+  e->next = lc->head;
+  if (lc->head)
+    lc->head->prev = e;
+  lc->head = e;
+}
+
+static void free_entry(LoopCache *lc, LoopEntry *e)
+{
+  lc->used -= e->frames * NUM_CHAN * sizeof(float);
+  free(e->audio);
+  free(e->snaps);
+  free(e);
+}
+
+static void publish(LoopCache *lc, LoopEntry *e)
+{
+  /* Hands the entry to the audio thread and waits (up to a second)
+     for it to be picked up, so the previous one is safe to evict. */
+  atomic_store(&lc->pending, e);
+  if (!lc->threaded)
+    atomic_store(&lc->active, e);
+  for (int i = 0; i < 1000 && atomic_load(&lc->active) != e; i++)
+    usleep(1000);
+}
+
+static void select_entry(LoopCache *lc, Synth *ps, Melody *pm)
+{
+  /* Call after the melody changes. Finds or creates the entry for
+     it, evicting least recently used entries to stay within the
+     budget. */
+  LoopEntry *e, *victim, *prev, *active, *pending;
+  long frames;
+  size_t bytes;
+
+  if (!lc->budget || pm->note_duration <= 0) {
+    publish(lc, NULL);
+    return;
+  }
+
+  for (e = lc->head; e; e = e->next)
+    if (matches(e, ps, pm))
+      break;
+  if (e) {
+    unlink_entry(lc, e);
+    push_front(lc, e);
+    publish(lc, e);
+    return;
+  }
+
+  frames = (long)NUM_COLS * pm->note_duration;
+  bytes = frames * NUM_CHAN * sizeof(float);
+
+  /* Make room, oldest first, skipping what the audio thread may use */
+  active = atomic_load(&lc->active);
+  pending = atomic_load(&lc->pending);
+  for (victim = lc->head; victim && victim->next; victim = victim->next)
+    ;
+  while (victim && lc->used + bytes > lc->budget) {
+    prev = victim->prev;
+    if (victim != active && victim != pending) {
+      unlink_entry(lc, victim);
+      free_entry(lc, victim);
+    }
+    victim = prev;
+  }
+  if (lc->used + bytes > lc->budget) {
+    publish(lc, NULL);
+    return;
+  }
+
+  e = calloc(1, sizeof(LoopEntry));
+  if (e) {
+    e->audio = malloc(bytes);
+    e->snaps = malloc((frames / LOOP_CACHE_SNAP + 1) * sizeof(Tone));
+  }
+  if (!e || !e->audio || !e->snaps) {
+    if (e) {
+      free(e->audio);
+      free(e->snaps);
+    }
+    free(e);
+    publish(lc, NULL);
+    return;
+  }
+  memcpy(e->freqs, pm->freqs, sizeof(e->freqs));
+  e->note_duration = pm->note_duration;
+  e->samp_rate = ps->samp_rate;
+  e->pitch_ratio = ps->pitch_ratio;
+  e->samples = ps->samples;
+  e->interp = ps->interp;
+  e->frames = frames;
+  atomic_init(&e->complete, 0);
+  lc->used += bytes;
+  push_front(lc, e);
+  publish(lc, e);
+}
+
+void loop_cache_select(LoopCache *lc, Synth *ps, Melody *pm)
+{
+  pthread_mutex_lock(&lc->lock);
+  select_entry(lc, ps, pm);
+  pthread_mutex_unlock(&lc->lock);
+}
+
+void loop_cache_retune(LoopCache *lc, Synth *ps, int note_duration)
+{
+  /* Call after a tempo (note_duration, 0 = unchanged) or synth
+     change: selects the entry for the selected melody as it will
+     now play. The melody itself may have come from any thread, so
+     it is taken from the entry selected last. */
+  LoopEntry *e;
+  Melody m;
+
+  pthread_mutex_lock(&lc->lock);
+  e = atomic_load(&lc->pending);
+  if (e) {
+    memcpy(m.freqs, e->freqs, sizeof(m.freqs));
+    m.note_duration = note_duration > 0 ? note_duration : e->note_duration;
+    select_entry(lc, ps, &m);
+  }
+  pthread_mutex_unlock(&lc->lock);
+}
+
+static void restore_tone(LoopCache *lc, Synth *ps, float *scratch,
+  unsigned long frames)
+{
+  /* The tone wasn't advanced while blocks came from the cache.
+     Rewind it to the last snapshot, less than LOOP_CACHE_SNAP frames
+     back, and re-render up to the current sample (into scratch) to
+     catch up. That bounds the extra work in this callback to about
+     one block, however long the steps are. */
+  LoopEntry *e = lc->served;
+  Melody m;
+  long nd = e->note_duration;
+  long pos = (long)ps->index_count * nd + ps->samp_count;
+  long from = pos - pos % LOOP_CACHE_SNAP, left = pos - from;
+  unsigned long n;
+  double ratio = ps->pitch_ratio;
+
+  // Catch up as the cached cycle was played, whatever changed since
+  memcpy(m.freqs, e->freqs, sizeof(m.freqs));
+  m.note_duration = e->note_duration;
+  ps->pitch_ratio = e->pitch_ratio;
+
+  ps->tone = e->snaps[from / LOOP_CACHE_SNAP];
+  ps->index_count = from / nd;
+  ps->samp_count = from % nd;
+  while (left > 0) {
+    n = left < (long)frames ? (unsigned long)left : frames;
+    render_block(ps, &m, scratch, n);
+    left -= n;
+  }
+  ps->pitch_ratio = ratio;
+
+  lc->served = NULL;
+  lc->tone_stale = 0;
+}
+
+void loop_cache_render(LoopCache *lc, Synth *ps, Melody *pm,
+  float *output, unsigned long frames)
+{
+  /* Renders like render_block(), copying from the cached cycle
+     when there is one for this melody. */
+  LoopEntry *e = atomic_load_explicit(&lc->pending, memory_order_acquire);
+  int match = matches(e, ps, pm);
+  long cycle, pos, n, nd;
+  int recording;
+  Melody m;
+
+  // Catch the tone up before the served entry can be evicted
+  if (lc->tone_stale && (e != lc->served || !match))
+    restore_tone(lc, ps, output, frames);
+  atomic_store_explicit(&lc->active, e, memory_order_release);
+
+  // A tempo change can leave us past the end of the (shorter) step
+  if (!match || ps->samp_count >= e->note_duration) {
+    lc->seen = NULL;
+    render_block(ps, pm, output, frames);
+    atomic_fetch_add_explicit(&lc->misses, 1, memory_order_relaxed);
+    return;
+  }
+
+  /* From here on play the entry's copy of the melody: another thread
+     may rewrite *pm in place while this block renders */
+  memcpy(m.freqs, e->freqs, sizeof(m.freqs));
+  m.note_duration = nd = e->note_duration;
+  cycle = e->frames;
+  while (frames > 0) {
+    pos = (long)ps->index_count * nd + ps->samp_count;
+
+    /* Count cycle starts: after two, a whole cycle of this melody
+       has played and the next one is the steady state */
+    if (pos == 0) {
+      if (lc->seen == e)
+        lc->cycles++;
+      else {
+        lc->seen = e;
+        lc->cycles = 1;
+      }
+    }
+    n = cycle - pos;
+    if (n > (long)frames)
+      n = frames;
+    if (n <= 0) {
+      // Can't happen with the snapshot; never index outside the cycle
+      lc->seen = NULL;
+      render_block(ps, &m, output, frames);
+      break;
+    }
+
+    if (lc->seen == e && lc->cycles >= 2 &&
+        atomic_load_explicit(&e->complete, memory_order_acquire)) {
+      /* Copy from the cache and move the step position along */
+      memcpy(output, e->audio + pos*NUM_CHAN, n * NUM_CHAN * sizeof(float));
+      pos = (pos + n) % cycle;
+      ps->index_count = pos / nd;
+      ps->samp_count = pos % nd;
+      lc->served = e;
+      lc->tone_stale = 1;
+      atomic_fetch_add_explicit(&lc->hits, 1, memory_order_relaxed);
+    } else {
+      /* Render live, recording the steady-state cycle and the tone
+         at each snapshot point */
+      recording = (lc->seen == e && lc->cycles >= 2);
+      if (recording) {
+        if (n > LOOP_CACHE_SNAP - pos % LOOP_CACHE_SNAP)
+          n = LOOP_CACHE_SNAP - pos % LOOP_CACHE_SNAP;
+        if (pos % LOOP_CACHE_SNAP == 0)
+          e->snaps[pos / LOOP_CACHE_SNAP] = ps->tone;
+      }
+      render_block(ps, &m, output, n);
+      if (recording) {
+        memcpy(e->audio + pos*NUM_CHAN, output, n * NUM_CHAN * sizeof(float));
+        if (pos + n == cycle)
+          atomic_store_explicit(&e->complete, 1, memory_order_release);
+      }
+      atomic_fetch_add_explicit(&lc->misses, 1, memory_order_relaxed);
+    }
+
+    output += n * NUM_CHAN;
+    frames -= n;
+  }
+}
+
+void loop_cache_free(LoopCache *lc)
+{
+  /* Frees every entry; the audio thread must be stopped. */
+  LoopEntry *e, *next;
+
+  for (e = lc->head; e; e = next) {
+    next = e->next;
+    free_entry(lc, e);
+  }
+  lc->head = NULL;
+  atomic_store(&lc->pending, NULL);
+  atomic_store(&lc->active, NULL);
+}
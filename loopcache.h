@@ -0,0 +1,58 @@
+#ifndef _LOOPCACHE_H_
+#define _LOOPCACHE_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "synth.h"
+#include "melody.h"
+
+#define LOOP_CACHE_BUDGET_MB  64  // default memory for cached cycles
+#define LOOP_CACHE_SNAP  FRAMES_PER_BUFFER // frames between tone snapshots
+
+/* One rendered cycle of a melody */
+typedef struct LoopEntry {
+  /* What was rendered: any change here means a different entry */
+  double freqs[NUM_COLS];
+  int note_duration;
+  int samp_rate;
+  double pitch_ratio;
+  const SamplePool *samples;
+  int interp;
+
+  float *audio;              // one cycle of interleaved stereo
+  long frames;               // cycle length in frames
+  Tone *snaps;               // tone every LOOP_CACHE_SNAP frames of the
+                             // cycle, to resume live rendering from
+  atomic_int complete;       // set by the audio thread once recorded
+  struct LoopEntry *prev, *next; // LRU list, most recent first
+} LoopEntry;
+
+/* Loop cache shared by the UI thread and the audio thread */
+typedef struct {
+  size_t budget;             // max bytes of cached audio
+  size_t used;               // bytes of cached audio
+  int threaded;              // 1 if another thread renders
+  pthread_mutex_t lock;      // serializes loop_cache_select() callers
+  LoopEntry *head;           // LRU list (UI thread only)
+  _Atomic(LoopEntry *) pending; // entry selected by the UI thread
+  _Atomic(LoopEntry *) active;  // entry acknowledged by the audio thread
+
+  /* Audio thread state */
+  LoopEntry *served;         // entry the last block was copied from
+  LoopEntry *seen;           // entry whose cycle start was last passed
+  int cycles;                // cycle starts passed while matching seen
+  int tone_stale;            // synth tone not advanced while serving
+  atomic_long hits;          // blocks served from the cache
+  atomic_long misses;        // blocks rendered live
+} LoopCache;
+
+/* loopcache.c function prototypes */
+void loop_cache_init(LoopCache *lc, size_t budget, int threaded);
+void loop_cache_select(LoopCache *lc, Synth *ps, Melody *pm);
+void loop_cache_retune(LoopCache *lc, Synth *ps, int note_duration);
+void loop_cache_render(LoopCache *lc, Synth *ps, Melody *pm,
+  float *output, unsigned long frames);
+void loop_cache_free(LoopCache *lc);
+
+#endif
@@ -7,19 +7,43 @@
 
 #include <stdio.h>
 #include <portaudio.h>
-// #include <sndfile.h>
 #include <ncurses.h>  // User interface
 #include <stdlib.h>   // For atoi()
 #include <string.h>   // For memset()
+#include <math.h>     // For log10()
 #include <dirent.h>   // For finding txt files in working directory
+#include <unistd.h>   // For getopt()
+#include <time.h>     // For clock_gettime()
 #include "paUtils.h"
+#include "rtUtils.h"
 #include "synth.h"
 #include "melody.h"
+#include "render.h"
+#include "stream.h"
+#include "transcribe.h"
+#include "loopcache.h"
+#include "ahead.h"
+#include "control.h"
+#include "tracks.h"
+#include "meter.h"
+#include "bounce.h"
+#include "sampler.h"
+#include "shmring.h"
+#include "loadtest.h"
+#include "outfmt.h"
+#include "record.h"
 
 /* Width and height of menu */
 #define WIDTH     30
 #define HEIGHT    10
 
+/* Meters in the read melody window */
+#define METER_X       34  // left edge of the meter panel
+#define METER_WIDTH   16  // characters in a level bar
+#define SPECTRUM_ROWS 8   // height of the spectrum display
+#define CLIP_HOLD     20  // refreshes the CLIP light stays on
+#define UI_REFRESH_MS 100 // meter refresh while waiting for a key
+
 /* Initialize ncurses params */
 int startx = 0;
 int starty = 0;
@@ -30,6 +54,7 @@ char* choices[] = {
 };
 const char* mel_choices[MAX_MELS][128];
 int n_choices = sizeof(choices) / sizeof(char *);
+int show_spectrum = 1; // s in the play melody window turns it off and on
 
 /* Portaudio callback structure */
 typedef struct {
@@ -37,7 +62,15 @@ typedef struct {
     Synth *ps;
     Melody *pm;
     int wav_out; // Sets to 1 if user chooses to record output
-    // SNDFILE *sndfile;
+    RtConfig *rt; // Real-time hardening applied to the callback thread
+    LoopCache *lc; // Rendered cycles of recently played melodies
+    RenderAhead *ra; // Render-ahead worker, or NULL to render in the callback
+    Control *ctl; // OSC control server, or NULL
+    TrackPool *tp; // Extra tracks mixed with the melody
+    Meter *meter; // Output levels for the UI
+    ShmRing *ring; // Shared memory copy of the output, or NULL
+    LoadStats *load; // Callback timings for the load test, or NULL
+    Recorder *rec; // Writes the output to a WAV file while wav_out is set
 } Buf;
 
 /* PortAudio callback function protoype */
@@ -54,9 +87,45 @@ void display_main_menu(WINDOW *menu_win, int highlight);
 void display_write_melody(WINDOW *write_melody_win, Melody* pm,
   int highlight_x, int highlight_y, int choice_x, int choice_y);
 void display_read_melody(WINDOW *read_melody_win, int highlight, int counter);
+void display_meters(WINDOW *read_melody_win, Buf *pb);
+
+/* Command line usage */
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+    "usage: %s                 interactive writer/player\n"
+    "       %s -s [options] melody.txt\n"
+    "       %s -t recording.wav [-o name] [-j threads]\n"
+    "       %s -b [-o out.wav] [-f fmt] [-d seconds] [-j threads] [-k] melody.txt\n"
+    "       %s -L device|null [-o results.json] [-d seconds] melody.txt\n"
+    "  -s          stream raw PCM instead of using the sound card\n"
+    "  -o path     output file or named FIFO (default - for stdout);\n"
+    "              where the play window records to (default out.wav)\n"
+    "  -f fmt      f32, s16 or s24 samples (default f32; s16 when recording)\n"
+    "  -S          noise shape the dither of s16 and s24\n"
+    "  -r          stream at real-time pace (default: as fast as possible)\n"
+    "  -d seconds  stop after this many seconds (default: forever)\n"
+    "  -R          harden the audio thread (SCHED_FIFO, mlock, FTZ/DAZ)\n"
+    "  -P prio     SCHED_FIFO priority for -R (default %d)\n"
+    "  -c cpu      pin the audio thread to this CPU (with -R)\n"
+    "  -C MB       memory for cached melody loops, 0 = off (default %d)\n"
+    "  -a blocks   render this many buffers ahead on a worker thread\n"
+    "  -p port     accept OSC control on UDP 127.0.0.1:port (e.g. %d)\n"
+    "  -w workers  threads rendering extra tracks (default: cores - 1)\n"
+    "  -t wav      transcribe a recording into name_NNNN.txt melodies\n"
+    "  -b          render to a WAV file (default melody.wav) on all cores\n"
+    "  -k          with -b, check the result against a one-thread render\n"
+    "  -j threads  threads for -t or -b (default: all cores)\n"
+    "  -i path     play a WAV sample, or a directory of them, not the sine\n"
+    "  -m name     share the output with other processes (e.g. /pentaseq)\n"
+    "  -L sink     find how many tracks the sound card or a null sink keeps\n"
+    "              up with; -d is the time at each step\n",
+    prog, prog, prog, prog, prog, RT_DEFAULT_PRIORITY, LOOP_CACHE_BUDGET_MB,
+    CTL_DEFAULT_PORT);
+}
 
 /* Main function */
-int main(void)
+int main(int argc, char *argv[])
 {
   /* Instantiate synth structure */
   Synth synth;
@@ -70,18 +139,61 @@ int main(void)
   Buf buf;
   PaStream *stream;
 
+  /* Real-time hardening options */
+  RtConfig rt;
+  char rt_str[128];
+
+  /* Loop cache */
+  LoopCache lc;
+  int cache_mb = LOOP_CACHE_BUDGET_MB;
+
+  /* Render-ahead worker */
+  RenderAhead ra;
+  int ahead_blocks = 0;
+
+  /* OSC control server */
+  Control ctl;
+  int ctl_port = 0;
+
+  /* Extra tracks and their worker threads */
+  static TrackPool tp;
+  int num_workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  Melody track_mel;
+
+  /* Output meters */
+  static Meter meter;
+
+  /* Sample instrument */
+  static SamplePool samples;
+  const char *samples_path = NULL;
+
+  /* Shared memory output ring */
+  static ShmRing ring;
+  const char *ring_name = NULL;
+
+  /* Load test */
+  static LoadStats load;
+  NullSink sink;
+  const char *load_sink = NULL;
+
+  /* Recording from the play window */
+  static Recorder rec;
+
   /* Instantiate Ncurses window structures */
   WINDOW* menu_win;
   WINDOW* write_melody_win;
   WINDOW* read_melody_win;
 
-  /* Instantiate SF_INFO struct for output file  */
-  // SF_INFO sfinfo;
-
   /* Initialize synth params */
   ps->samp_rate = SAMP_RATE;
   ps->samp_count = 0;
   ps->index_count = 0;
+  ps->pitch_ratio = 1.0;
+  ps->samples = NULL; // The sine, unless -i gives samples
+  ps->interp = SAMPLER_LINEAR;
+  ps->tone.sample = NULL;
+  ps->tone.phase_inc = -1; // Silent until the first note
+  ps->tone.decay_amp = 0;
 
   /* Initialize melody params */
   pm->note_duration = 0;
@@ -94,16 +206,290 @@ int main(void)
   int choice = 0;
   int c;
 
-  /* Initialize Portaudio buf params */
+  /* Command line options */
+  rt_init(&rt);
+  int stream_mode = 0, out_fmt = 0, shape = 0, realtime = 0;
+  const char *stream_path = "-";
+  double seconds = 0;
+  const char *trans_path = NULL;
+  int num_threads = 0;
+  int bounce_mode = 0, verify = 0;
+
+  while ((c = getopt(argc, argv, "so:f:Srd:RP:c:C:a:p:w:t:j:bki:m:L:")) != -1) {
+    switch (c) {
+      case 's':
+        stream_mode = 1;
+        break;
+      case 'o':
+        stream_path = optarg;
+        break;
+      case 'f':
+        if ((out_fmt = outfmt_parse(optarg)) < 0) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'S':
+        shape = 1;
+        break;
+      case 'r':
+        realtime = 1;
+        break;
+      case 'd':
+        seconds = atof(optarg);
+        break;
+      case 'R':
+        rt.enabled = 1;
+        break;
+      case 'P':
+        rt.priority = atoi(optarg);
+        break;
+      case 'c':
+        rt.cpu = atoi(optarg);
+        break;
+      case 'C':
+        cache_mb = atoi(optarg);
+        break;
+      case 'a':
+        ahead_blocks = atoi(optarg);
+        break;
+      case 'p':
+        ctl_port = atoi(optarg);
+        break;
+      case 'w':
+        num_workers = atoi(optarg);
+        break;
+      case 't':
+        trans_path = optarg;
+        break;
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 'b':
+        bounce_mode = 1;
+        break;
+      case 'k':
+        verify = 1;
+        break;
+      case 'i':
+        samples_path = optarg;
+        break;
+      case 'm':
+        ring_name = optarg;
+        break;
+      case 'L':
+        if (strcmp(optarg, "device") != 0 && strcmp(optarg, "null") != 0) {
+          usage(argv[0]);
+          return 1;
+        }
+        load_sink = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  /* Initialize Portaudio buf params; every optional part starts off,
+     before any mode runs */
+  memset(&buf, 0, sizeof(buf));
   buf.num_chan = NUM_CHAN;
   buf.ps = ps;
   buf.pm = pm;
-  buf.wav_out = 0;
+  buf.rt = &rt;
+  buf.lc = &lc;
+  buf.tp = &tp;
+  buf.meter = &meter;
+  meter_init(&meter);
+
+  /* Transcribe mode: recording in, melody files out */
+  if (trans_path) {
+    char base[1024];
+    if (strcmp(stream_path, "-") != 0)
+      snprintf(base, sizeof(base), "%s", stream_path);
+    else {
+      // Default to the recording's name without the extension
+      snprintf(base, sizeof(base), "%s", trans_path);
+      char *dot = strrchr(base, '.');
+      if (dot && strcmp(dot, ".wav") == 0)
+        *dot = '\0';
+    }
+    return transcribe_wav(trans_path, base, num_threads) < 0;
+  }
+
+  /* Map the instrument's samples; they are read in as they are played */
+  if (samples_path) {
+    if (sampler_load(&samples, samples_path) < 0)
+      return 1;
+    ps->samples = &samples;
+  }
+
+  /* Bounce mode: render a melody to a WAV file, as fast as possible */
+  if (bounce_mode) {
+    char out[1024];
+    if (optind >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    pm->filename = argv[optind];
+    if (read_melody(pm) < 0)
+      return 1;
+    make_freqs(pm);
+    if (strcmp(stream_path, "-") != 0)
+      snprintf(out, sizeof(out), "%s", stream_path);
+    else {
+      // Default to the melody's name with .wav for .txt
+      snprintf(out, sizeof(out), "%s", pm->filename);
+      char *dot = strrchr(out, '.');
+      if (dot && strcmp(dot, ".txt") == 0)
+        *dot = '\0';
+      strncat(out, ".wav", sizeof(out) - strlen(out) - 1);
+    }
+    ps->interp = SAMPLER_CUBIC; // No deadline: best interpolation
+    c = bounce_wav(ps, pm, out, seconds, out_fmt ? out_fmt : OUT_F32, shape,
+      num_threads, verify);
+    sampler_free(&samples);
+    return c < 0;
+  }
+
+  /* Stream mode: no sound card and no ncurses, just PCM out */
+  if (stream_mode) {
+    if (optind >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    pm->filename = argv[optind];
+    if (read_melody(pm) < 0)
+      return 1;
+    make_freqs(pm);
+    if (!realtime)
+      ps->interp = SAMPLER_CUBIC; // No deadline: best interpolation
+    // The render runs on this thread, so harden it directly
+    rt_prepare_process(&rt);
+    rt_prepare_thread(&rt);
+    if (rt.enabled) {
+      rt_report(&rt, rt_str, sizeof(rt_str));
+      fprintf(stderr, "%s\n", rt_str);
+    }
+    loop_cache_init(&lc, (size_t)cache_mb << 20, 0);
+    loop_cache_select(&lc, ps, pm);
+    if (ctl_port > 0) {
+      // From here on melodies are selected from the control thread
+      lc.threaded = 1;
+      if (control_start(&ctl, ctl_port, &lc, ps, NULL,
+          realtime ? FRAMES_PER_BUFFER : 0) < 0)
+        return 1;
+      buf.ctl = &ctl;
+    }
+    c = stream_pcm(buf.ctl, &lc, ps, pm, stream_path,
+      out_fmt ? out_fmt : OUT_F32, shape, realtime, seconds);
+    if (buf.ctl)
+      control_stop(&ctl);
+    loop_cache_free(&lc);
+    sampler_free(&samples);
+    return c < 0;
+  }
+
+  /* Load test mode: the callback as in interactive mode, ever more tracks */
+  if (load_sink) {
+    FILE *json = stdout;
+    if (optind >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    pm->filename = argv[optind];
+    if (read_melody(pm) < 0)
+      return 1;
+    make_freqs(pm);
+    if (strcmp(stream_path, "-") != 0 && !(json = fopen(stream_path, "w"))) {
+      fprintf(stderr, "ERROR: could not create %s\n", stream_path);
+      return 1;
+    }
+    load_init(&load);
+    buf.load = &load;
+    loop_cache_init(&lc, (size_t)cache_mb << 20, 0);
+    loop_cache_select(&lc, ps, pm);
+    lc.threaded = 1;
+    if (tracks_start(&tp, num_workers, rt.cpu >= 0 ? rt.cpu + 1 : -1,
+        &rt) < 0)
+      return 1;
+    tp.samples = ps->samples;
+    rt_prepare_process(&rt);
+    if (strcmp(load_sink, "device") == 0)
+      stream = startupPa(1, NUM_CHAN,
+          SAMP_RATE, FRAMES_PER_BUFFER, paCallback, &buf);
+    else if (null_sink_start(&sink, paCallback, &buf, &load) < 0)
+      return 1;
+    if (rt.enabled) {
+      usleep(100000); // Let the first callback harden its thread
+      rt_report(&rt, rt_str, sizeof(rt_str));
+      fprintf(stderr, "%s\n", rt_str);
+    }
+    c = load_test(&load, &tp, pm, load_sink, seconds, json);
+    if (strcmp(load_sink, "device") == 0)
+      shutdownPa(stream);
+    else
+      null_sink_stop(&sink);
+    tracks_stop(&tp);
+    loop_cache_free(&lc);
+    sampler_free(&samples);
+    if (json != stdout)
+      fclose(json);
+    return c < 0;
+  }
+
+  /* The callback renders through the loop cache */
+  loop_cache_init(&lc, (size_t)cache_mb << 20, 1);
+
+  /* Track workers go on the cores after the audio thread's */
+  if (tracks_start(&tp, num_workers, rt.cpu >= 0 ? rt.cpu + 1 : -1,
+      &rt) < 0)
+    return 1;
+  tp.samples = ps->samples;
+
+  /* Optionally take commands over OSC; timed ones are due when heard */
+  if (ctl_port > 0) {
+    if (control_start(&ctl, ctl_port, &lc, ps, &buf.wav_out,
+        (long long)FRAMES_PER_BUFFER * (1 + ahead_blocks)) < 0)
+      return 1;
+    buf.ctl = &ctl;
+  }
+
+  /* Optionally move rendering off the callback onto a worker */
+  if (ahead_blocks > 0) {
+    if (ahead_start(&ra, ahead_blocks, buf.ctl, &lc, &tp, ps, pm, &rt) < 0)
+      return 1;
+    buf.ra = &ra;
+  }
+
+  /* Optionally publish the output for other processes */
+  if (ring_name) {
+    if (shm_ring_create(&ring, ring_name, SAMP_RATE, NUM_CHAN,
+        FRAMES_PER_BUFFER) < 0)
+      return 1;
+    buf.ring = &ring;
+  }
+
+  /* Recording goes through a writer thread; 16-bit like out.wav was */
+  if (recorder_start(&rec, strcmp(stream_path, "-") != 0 ?
+      stream_path : RECORD_DEFAULT_PATH, out_fmt ? out_fmt : OUT_S16,
+      shape) < 0)
+    return 1;
+  buf.rec = &rec;
+
+  /* Lock memory before the audio thread starts */
+  rt_prepare_process(&rt);
 
   /* Start PortAudio */
   stream = startupPa(1, NUM_CHAN,
       SAMP_RATE, FRAMES_PER_BUFFER, paCallback, &buf);
 
+  /* Timed commands: what we render is heard after the render-ahead
+     buffers plus the device's own latency, now that it is known */
+  if (buf.ctl && stream && Pa_GetStreamInfo(stream))
+    control_set_latency(&ctl, (long long)FRAMES_PER_BUFFER * ahead_blocks +
+      (long long)(Pa_GetStreamInfo(stream)->outputLatency * SAMP_RATE));
+
   /* Start ncurses mode */
   initscr();
   cbreak();
@@ -118,6 +504,13 @@ int main(void)
   menu_win = newwin(HEIGHT, WIDTH, starty, startx);
   keypad(menu_win, TRUE); // Allow F1 etc. keys
   mvprintw(0,0,"Main menu: Arrow keys to navigate, enter to select an option");
+  if (rt.enabled) {
+    // Give the callback thread a moment to harden itself, then report
+    for (int i = 0; i < 50 && !atomic_load(&rt.thread_done); i++)
+      usleep(10000);
+    rt_report(&rt, rt_str, sizeof(rt_str));
+    mvprintw(1,0,"%s", rt_str);
+  }
   refresh();
 
   /* Print main menu */
@@ -315,12 +708,16 @@ int main(void)
     }
 
     display_read_melody(read_melody_win, highlight, counter);
-    int only_once = 0; // Don't worry about it
+    timeout(UI_REFRESH_MS); // Keep the meters moving between keys
 
     /* While loop 3: Read melody window */
     while(1)
     {
       c = getch();
+      if (c == ERR) { // No key: just refresh the meters
+        display_meters(read_melody_win, &buf);
+        continue;
+      }
       switch(c)
       {
         case 65: // Up arrow
@@ -341,9 +738,23 @@ int main(void)
           else // If no melodies
             exit = 1;
           break;
-        case 114: // r - record
-          buf.wav_out = 1; // Record!
-          only_once = 1;
+        case 97: // a - add highlighted melody as an extra track
+          if (counter) {
+            track_mel.filename = mel_choices[highlight-1];
+            if (read_melody(&track_mel) == 0) {
+              make_freqs(&track_mel);
+              tracks_add(&tp, &track_mel);
+            }
+          }
+          break;
+        case 99: // c - clear extra tracks
+          tracks_clear(&tp);
+          break;
+        case 114: // r - start or stop recording
+          buf.wav_out = !buf.wav_out;
+          break;
+        case 115: // s - show or hide the spectrum
+          show_spectrum = !show_spectrum;
           break;
         case 113: // q - quit
           exit = 1;
@@ -353,25 +764,13 @@ int main(void)
           break;
       }
 
-      // if (buf.wav_out && only_once) { // Set up recording
-      //   const char* melody_wav_name = pm->filename;
-      //   /* Initialize sndfile output params */
-      //   memset(&sfinfo, 0, sizeof(sfinfo));
-      //   sfinfo.samplerate = SAMP_RATE;
-      //   sfinfo.channels = NUM_CHAN;
-      //   sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-      //   if ( (buf.sndfile = sf_open ("out.wav", SFM_WRITE, &sfinfo)) == NULL ) {
-      //       fprintf (stderr, "Error: could not open output wav file\n");
-      //       return -1;
-      //   }
-      //   only_once = 0;
-      // }
-
       display_read_melody(read_melody_win, highlight, counter);
+      display_meters(read_melody_win, &buf);
       if (choice != 0) {
         pm->filename = mel_choices[choice-1];
         read_melody(pm); // Reads melody to melody struct
         make_freqs(pm);  // Converts melody notes to frequencies
+        loop_cache_select(&lc, ps, pm); // Replay its cycle once rendered
       }
       if (exit)
         break;
@@ -386,12 +785,18 @@ int main(void)
     refresh();
   }
 
-  // if (buf.wav_out)
-  //     /* close debugging output wav file */
-  //     sf_close (buf.sndfile);
-
   /* Close PortAudio and Ncurses */
   shutdownPa(stream);
+  recorder_stop(&rec);
+  if (buf.ra)
+    ahead_stop(&ra);
+  if (buf.ctl)
+    control_stop(&ctl);
+  tracks_stop(&tp);
+  loop_cache_free(&lc);
+  sampler_free(&samples);
+  if (buf.ring)
+    shm_ring_close(&ring);
   delwin(menu_win);
   endwin();
 
@@ -482,7 +887,7 @@ void display_read_melody(WINDOW *read_melody_win, int highlight, int counter)
 
   // If there are melodies
   if(counter) {
-    mvwprintw(read_melody_win, y, x, "Enter->select, r->rec, q->quit");
+    mvwprintw(read_melody_win, y, x, "Enter->select a->add c->clear r->rec s->spec q->quit");
     y++;
     for (i = 0; i < counter; i++) {
       // Implement highlight
@@ -506,9 +911,81 @@ void display_read_melody(WINDOW *read_melody_win, int highlight, int counter)
   wrefresh(read_melody_win);
 }
 
-/* Audio callback calls the play_note() and synth_sample() functions,
-   which synthesizes one sample of audio at a time
-   and uses the melody's freqs array to get the frequencies */
+/* Meter panel on the right of the read melody window: level bars,
+   a CLIP light that holds for a moment, a coarse spectrum, and
+   the track and render-ahead counters. */
+void display_meters(WINDOW *read_melody_win, Buf *pb)
+{
+  static unsigned long clips_seen = 0;
+  static int clip_hold = 0;
+  MeterData d;
+  float bands[METER_BANDS], db;
+  char bar[METER_WIDTH+1];
+  int i, j, x = METER_X, y = 3, room;
+
+  meter_read(pb->meter, &d);
+
+  /* Level bars: = up to RMS, | at the peak */
+  for (i = 0; i < NUM_CHAN; i++) {
+    int rms_len, peak_pos;
+    db = d.rms[i] > 0 ? 20*log10(d.rms[i]) : METER_FLOOR;
+    rms_len = (int)((db - METER_FLOOR) / -METER_FLOOR * METER_WIDTH);
+    db = d.peak[i] > 0 ? 20*log10(d.peak[i]) : METER_FLOOR;
+    peak_pos = (int)((db - METER_FLOOR) / -METER_FLOOR * METER_WIDTH);
+    for (j = 0; j < METER_WIDTH; j++)
+      bar[j] = j < rms_len ? '=' : ' ';
+    if (peak_pos > 0)
+      bar[peak_pos < METER_WIDTH ? peak_pos - 1 : METER_WIDTH - 1] = '|';
+    bar[METER_WIDTH] = '\0';
+    mvwprintw(read_melody_win, y+i, x, "%c[%s]%4.0f", i ? 'R' : 'L', bar,
+      db < METER_FLOOR ? METER_FLOOR : db);
+  }
+
+  /* CLIP light */
+  if (d.clips != clips_seen) {
+    clips_seen = d.clips;
+    clip_hold = CLIP_HOLD;
+  }
+  if (clip_hold > 0) {
+    clip_hold--;
+    wattron(read_melody_win, A_REVERSE);
+    mvwprintw(read_melody_win, y+2, x, "CLIP");
+    wattroff(read_melody_win, A_REVERSE);
+  } else {
+    mvwprintw(read_melody_win, y+2, x, "    ");
+  }
+
+  /* Spectrum, low to high, 0 dB at the top; blank and not worked
+     out at all while hidden */
+  if (show_spectrum)
+    meter_spectrum(&d, bands);
+  y += 4;
+  for (j = 0; j < SPECTRUM_ROWS; j++) {
+    float level = -METER_FLOOR * (j + 1) / SPECTRUM_ROWS + METER_FLOOR;
+    for (i = 0; i < METER_BANDS; i++)
+      mvwaddch(read_melody_win, y + SPECTRUM_ROWS - 1 - j, x + 2 + i,
+        show_spectrum && bands[i] >= level ? '#' : ' ');
+  }
+  y += SPECTRUM_ROWS + 1;
+
+  mvwprintw(read_melody_win, y, x, "tracks: %2d", atomic_load(&pb->tp->num_tracks));
+  /* Recording light, with any audio the writer fell too far behind
+     for, cut off short of the window border */
+  room = getmaxx(read_melody_win) - 1 - (x + 12);
+  if (pb->rec && pb->wav_out && atomic_load(&pb->rec->dropped))
+    snprintf(bar, sizeof(bar), "REC %ld lost", atomic_load(&pb->rec->dropped));
+  else
+    snprintf(bar, sizeof(bar), "%s", pb->rec && pb->wav_out ? "REC" : "");
+  mvwprintw(read_melody_win, y, x + 12, "%-*.*s", room, room, bar);
+  if (pb->ra)
+    mvwprintw(read_melody_win, y+1, x, "ahead: %ld dry (%ld fr)",
+      atomic_load(&pb->ra->underruns), atomic_load(&pb->ra->dry_frames));
+  wrefresh(read_melody_win);
+}
+
+/* Audio callback hands the output buffer to render_block(),
+   which synthesizes the melody one sample at a time
+   using the melody's freqs array to get the frequencies */
 static int paCallback(
     const void *inputBuffer,
     void *outputBuffer,
@@ -522,44 +999,36 @@ static int paCallback(
     Melody *pm = pb->pm;
     float *output = (float *)outputBuffer;
     //float *input = (float *)inputBuffer; /* input not used in this code */
+    struct timespec start, end;
 
-    /* Initialize note at beginning of count */
-    if ((ps->index_count == 0) && (ps->samp_count == 0))
-      play_note(ps,pm->freqs[ps->index_count]);
-
-    /* Iterate each sample in the buffer */
-    for ( int i = 0; i < framesPerBuffer; i++ ) {
-      // Synthesize each sample
-      output[2*i] = synth_sample(ps);
-      output[2*i + 1] = synth_sample(ps);
-      // Increment sample count
-      ps->samp_count++;
-
-      /* If samp count reaches note duration */
-      if (ps->samp_count >= pm->note_duration) {
-        // Increment index count
-        ps->index_count++;
-        // Reset sample count
-        ps->samp_count = 0;
-
-        // If there is a new note, play the new note
-          // (Otherwise let the previous note ring out)
-        if (pm->freqs[ps->index_count])
-          play_note(ps,pm->freqs[ps->index_count]);
-
-        if (ps->index_count == 0)
-          printf("%2f / ", pm->freqs[ps->index_count]);
-
-        // If end reached, loop melody - start from beginning
-        if (ps->index_count >= NUM_COLS) {
-          ps->index_count = 0;
-        }
-      }
-    }
+    /* Time the whole callback for the load test */
+    if (pb->load)
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* First callback in hardened mode: set up this thread */
+    rt_prepare_thread(pb->rt);
 
-  // if (pb->wav_out)
-    /* write to output file */
-    // sf_writef_float (pb->sndfile, output, framesPerBuffer);
+    if (pb->ra) // Worker already rendered it: just copy out
+      ahead_read(pb->ra, output, framesPerBuffer);
+    else
+      control_render(pb->ctl, pb->lc, pb->tp, ps, pm, output, framesPerBuffer);
+
+    /* Levels for the meters, as they leave for the device */
+    meter_publish(pb->meter, output, framesPerBuffer);
+
+    /* Same audio to any local readers; never waits for them */
+    if (pb->ring)
+      shm_ring_write(pb->ring, output, framesPerBuffer);
+
+    /* Recording: queued for the writer thread, converted there */
+    if (pb->rec)
+      recorder_push(pb->rec, output, framesPerBuffer, pb->wav_out);
+
+    if (pb->load) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      load_record(pb->load, (end.tv_sec - start.tv_sec) * 1000000000LL +
+        end.tv_nsec - start.tv_nsec, (statusFlags & paOutputUnderflow) != 0);
+    }
 
     return 0;
 }
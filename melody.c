@@ -7,58 +7,60 @@
 #define TEMPO_STR_LEN         4
 #define SCALE_STR_LEN         2
 #define START_NOTE_STR_LEN    3
-#define SCALE_MAJ             1
-#define SCALE_MIN             2
+
+static int read_line(FILE *fp, char *str, int len)
+{
+  /* Reads one line of at most len-1 characters into str.
+     Returns -1 at the end of the file or if the line is longer. */
+  int c, cnt = 0;
+
+  while ((c = fgetc(fp)) != '\n') {
+    if (c == '\r')
+      continue;
+    if (c == EOF || cnt >= len - 1)
+      return -1;
+    str[cnt++] = c;
+  }
+  str[cnt] = '\0';
+  return 0;
+}
 
 int read_melody(Melody* pm)
 {
   /* Reads melody from properly formatted txt file
-     to Melody struct. */
+     to Melody struct. Anything else is an error, and
+     leaves the Melody struct as it was. */
   char tempo_str[TEMPO_STR_LEN];
   char scale_str[SCALE_STR_LEN];
   char start_note_str[START_NOTE_STR_LEN];
-  char c;
-  int k, cnt;
+  Melody m = *pm;
+  int c, k;
 
   FILE *fp = fopen(pm->filename, "r");
   if (!fp) {
-    fprintf(stderr, "File open failed");
+    fprintf(stderr, "ERROR: could not open %s\n", pm->filename);
     return -1;
   }
 
-  /* read tempo */
-  cnt = 0;
-  while ((c = fgetc(fp)) != '\n') {
-    // Check to make sure the read worked
-    if (!c) {
-      fprintf(stderr, "File read failed");
-      return -1;
-    }
-    tempo_str[cnt] = c;
-    cnt++;
-  }
-  tempo_str[cnt] = '\0';
-  pm->tempo = atoi(tempo_str);
-  // Set note duration based on tempo
-  pm->note_duration = SAMP_RATE/((pm->tempo*4)/60);
-
-  /* read scale */
-  cnt = 0;
-  while ((c = fgetc(fp)) != '\n') {
-    scale_str[cnt] = c;
-    cnt++;
+  /* read tempo, scale and start note, one per line */
+  if (read_line(fp, tempo_str, TEMPO_STR_LEN) < 0 ||
+      read_line(fp, scale_str, SCALE_STR_LEN) < 0 ||
+      read_line(fp, start_note_str, START_NOTE_STR_LEN) < 0) {
+    fprintf(stderr, "ERROR: %s is not a melody file\n", pm->filename);
+    fclose(fp);
+    return -1;
   }
-  scale_str[cnt] = '\0';
-  pm->scale = atoi(scale_str);
-
-  /* read start note */
-  cnt = 0;
-  while ((c = fgetc(fp)) != '\n') {
-    start_note_str[cnt] = c;
-    cnt++;
+  m.tempo = atoi(tempo_str);
+  m.scale = atoi(scale_str);
+  m.start_note = atoi(start_note_str);
+  if (m.tempo < TEMPO_MIN || m.tempo > TEMPO_MAX) {
+    fprintf(stderr, "ERROR: %s: tempo must be %d to %d\n", pm->filename,
+      TEMPO_MIN, TEMPO_MAX);
+    fclose(fp);
+    return -1;
   }
-  start_note_str[cnt] = '\0';
-  pm->start_note = atoi(start_note_str);
+  // Set note duration based on tempo
+  m.note_duration = SAMP_RATE/((m.tempo*4)/60);
 
   /* read note values */
   for (int i = 0; i < NUM_COLS; i++) {
@@ -66,13 +68,19 @@ int read_melody(Melody* pm)
     if (c == ',') {
       i--;
       continue;
-    } else {
-      // Convert to int
-      k = c - '0';
-      pm->notes[i] = k;
     }
+    // Convert to int
+    k = c - '0';
+    if (c == EOF || k < 0 || k >= NUM_ROWS) {
+      fprintf(stderr, "ERROR: %s: missing or bad note %d\n", pm->filename,
+        i + 1);
+      fclose(fp);
+      return -1;
+    }
+    m.notes[i] = k;
   }
   fclose(fp);
+  *pm = m;
   return 0;
 }
 
@@ -7,12 +7,16 @@
 #define NUM_ROWS   7    // Number of rows = number of possible notes to play
                         // (including no note)
 #define MAX_MELS   16   // Max number of melodies to load in read melody window
+#define SCALE_MAJ  1    // Major pentatonic
+#define SCALE_MIN  2    // Minor pentatonic
+#define TEMPO_MIN  15   // Slowest tempo: one step per second
+#define TEMPO_MAX  999  // Fastest tempo: three digits in a melody file
 
 /* Melody struct */
 typedef struct {
   const char* filename;        // melody filename
   int tempo;                   // in BPM
-  int scale;                   // 0 is major pentatonic, 1 is minor pentatonic
+  int scale;                   // SCALE_MAJ or SCALE_MIN
   int start_note;              // MIDI number, ex. 48 is middle C
   int notes[NUM_COLS];         // array of notes 0 to 6
   double freqs[NUM_COLS];      // array of corresponding frequencies
@@ -0,0 +1,114 @@
+/*
+ * Output meters. The audio thread does only the cheap part: peak, RMS
+ * and clip count for each block, and a decimated copy of the signal.
+ * It publishes them under a sequence lock, so it never waits. The UI
+ * thread copies them out (retrying if it raced a write) and does the
+ * FFT for the spectrum itself.
+ */
+
+#include <string.h>  // for memset()
+#include <math.h>    // for sqrt(), log10()
+#include "meter.h"
+#include "fft.h"
+
+void meter_init(Meter *m)
+{
+  memset(&m->data, 0, sizeof(m->data));
+  atomic_init(&m->seq, 0);
+}
+
+void meter_publish(Meter *m, const float *output, unsigned long frames)
+{
+  /* Audio thread: measures one block of interleaved output. */
+  MeterData *d = &m->data;
+  float peak[NUM_CHAN] = {0}, v;
+  double sum[NUM_CHAN] = {0};
+  unsigned long clips = 0, i;
+  unsigned int seq;
+  int c, pos;
+  // Bars hold the loudest recent level and fall back at METER_FALL
+  float fall = powf(10, -METER_FALL/20 * frames / SAMP_RATE);
+
+  for (i = 0; i < frames; i++) {
+    for (c = 0; c < NUM_CHAN; c++) {
+      v = fabsf(output[i*NUM_CHAN + c]);
+      if (v > peak[c])
+        peak[c] = v;
+      if (v >= 1.0f)
+        clips++;
+      sum[c] += v*v;
+    }
+  }
+
+  seq = atomic_load_explicit(&m->seq, memory_order_relaxed);
+  atomic_store_explicit(&m->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  for (c = 0; c < NUM_CHAN; c++) {
+    float rms = frames ? sqrt(sum[c] / frames) : 0;
+    d->peak[c] = fmaxf(peak[c], d->peak[c] * fall);
+    d->rms[c] = fmaxf(rms, d->rms[c] * fall);
+  }
+  d->clips += clips;
+  d->blocks++;
+
+  // Mono, averaged in pairs of frames as a cheap anti-alias filter
+  pos = d->snap_pos;
+  for (i = 0; i + METER_DECIM <= frames; i += METER_DECIM) {
+    v = 0;
+    for (unsigned long k = i; k < i + METER_DECIM; k++)
+      for (c = 0; c < NUM_CHAN; c++)
+        v += output[k*NUM_CHAN + c];
+    d->snap[pos] = v / (METER_DECIM * NUM_CHAN);
+    pos = (pos + 1) % METER_SNAP;
+  }
+  d->snap_pos = pos;
+
+  atomic_store_explicit(&m->seq, seq + 2, memory_order_release);
+}
+
+void meter_read(Meter *m, MeterData *copy)
+{
+  /* UI thread: copies a consistent snapshot of the latest block. */
+  unsigned int s1, s2;
+
+  do {
+    s1 = atomic_load_explicit(&m->seq, memory_order_acquire);
+    memcpy(copy, &m->data, sizeof(*copy));
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit(&m->seq, memory_order_relaxed);
+  } while ((s1 & 1) || s1 != s2);
+}
+
+void meter_spectrum(const MeterData *d, float *bands)
+{
+  /* UI thread: Hann-windowed FFT of the snapshot, summed into
+     METER_BANDS log-spaced bands, in dB. */
+  float re[METER_SNAP], im[METER_SNAP];
+  double rate = (double)SAMP_RATE / METER_DECIM, lo = 50, hi = rate/2;
+  int i, b, k0, k1;
+
+  for (i = 0; i < METER_SNAP; i++) {
+    double w = 0.5 - 0.5*cos(2*PI*i/(METER_SNAP - 1));
+    re[i] = w * d->snap[(d->snap_pos + i) % METER_SNAP];
+    im[i] = 0;
+  }
+  fft(re, im, METER_SNAP);
+
+  for (b = 0; b < METER_BANDS; b++) {
+    double f0 = lo * pow(hi/lo, (double)b/METER_BANDS);
+    double f1 = lo * pow(hi/lo, (double)(b+1)/METER_BANDS);
+    double power = 0;
+    k0 = (int)(f0 * METER_SNAP / rate);
+    k1 = (int)(f1 * METER_SNAP / rate);
+    if (k1 <= k0)
+      k1 = k0 + 1;
+    for (i = k0; i < k1 && i < METER_SNAP/2; i++)
+      power += re[i]*re[i] + im[i]*im[i];
+    // Scale so a full-scale sine reads about 0 dB
+    power *= 16.0 / ((double)METER_SNAP * METER_SNAP);
+    bands[b] = power > 0 ? 10*log10(power) : METER_FLOOR;
+    if (bands[b] < METER_FLOOR)
+      bands[b] = METER_FLOOR;
+  }
+}
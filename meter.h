@@ -0,0 +1,35 @@
+#ifndef _METER_H_
+#define _METER_H_
+
+#include <stdatomic.h>
+#include "synth.h"
+
+#define METER_SNAP    512   // samples in the spectrum snapshot
+#define METER_DECIM   2     // snapshot is mono, at SAMP_RATE/METER_DECIM
+#define METER_BANDS   16    // spectrum bands shown
+#define METER_FLOOR   -60.0 // dB at the bottom of the meters
+#define METER_FALL    20.0  // dB per second the bars fall back
+
+/* Levels as of the latest block */
+typedef struct {
+  float peak[NUM_CHAN];        // max |sample| per channel, falling back
+  float rms[NUM_CHAN];         // RMS per channel, falling back
+  unsigned long clips;         // total samples at or over full scale so far
+  unsigned long blocks;        // blocks published so far
+  int snap_pos;                // next write position in snap
+  float snap[METER_SNAP];      // recent mono samples, a ring
+} MeterData;
+
+/* Published by the audio thread under a sequence lock */
+typedef struct {
+  atomic_uint seq;             // odd while the audio thread is writing
+  MeterData data;
+} Meter;
+
+/* meter.c function prototypes */
+void meter_init(Meter *m);
+void meter_publish(Meter *m, const float *output, unsigned long frames);
+void meter_read(Meter *m, MeterData *copy);
+void meter_spectrum(const MeterData *d, float *bands);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Output formats: float blocks from the synth to the bytes that go in
+ * a file or a pipe. PCM gets TPDF dither, one LSB either way, so the
+ * rounding error becomes a steady hiss instead of distortion on quiet
+ * notes. With shaping, the dither goes through second-order error
+ * feedback that moves the noise out of the low and middle frequencies.
+ *
+ * Dither comes from four xorshift32 generators side by side, so the
+ * SSE2 path does four samples at a time. The plain C path steps the
+ * lanes the same way and gives the same output. Error feedback needs
+ * each sample's result before the next, so shaping is always plain C.
+ */
+
+#include <string.h>  // for memcpy()
+#include <math.h>    // for lrintf()
+#include "outfmt.h"
+#include "wav.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define QUANT_BLOCK   1024  // samples quantized at a time
+#define SHAPE_B1      1.6f  // noise transfer (1 - 0.8/z)^2: zeros near DC
+#define SHAPE_B2      -0.64f
+
+int outfmt_parse(const char *name)
+{
+  /* Format named on the command line, or -1. */
+  if (strcmp(name, "f32") == 0)
+    return OUT_F32;
+  if (strcmp(name, "s16") == 0)
+    return OUT_S16;
+  if (strcmp(name, "s24") == 0)
+    return OUT_S24;
+  return -1;
+}
+
+void outfmt_init(OutFmt *of, int format, int shape)
+{
+  of->format = format;
+  of->shape = shape;
+  outfmt_reset(of, 0);
+}
+
+void outfmt_reset(OutFmt *of, unsigned long long seed)
+{
+  /* Restarts the dither and the error feedback. The same seed gives
+     the same output for the same input, wherever it is converted. */
+  for (int i = 0; i < 4; i++) {
+    unsigned long long z = seed * 4 + i + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    of->rng[i] = (uint32_t)z ? (uint32_t)z : 1; // xorshift can't be 0
+  }
+  memset(of->err, 0, sizeof(of->err));
+}
+
+int outfmt_bits(int format)
+{
+  return format == OUT_S16 ? 16 : format == OUT_S24 ? 24 : 32;
+}
+
+int outfmt_wav_format(int format)
+{
+  return format == OUT_F32 ? WAV_FMT_FLOAT : WAV_FMT_PCM;
+}
+
+static inline uint32_t xorshift(uint32_t *x)
+{
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+static inline float tpdf(uint32_t r)
+{
+  /* Sum of two uniform 16-bit halves: triangular over -1..1 LSB. */
+  return (float)(int32_t)((r & 0xFFFF) + (r >> 16)) * (1.0f/65536) - 1.0f;
+}
+
+static void quantize(OutFmt *of, const float *in, int32_t *q,
+  unsigned long n, float scale)
+{
+  /* Scales, dithers and rounds n samples, clipping to full scale. */
+  float hi = scale - 1, lo = -scale;
+  unsigned long i = 0;
+
+#if defined(__SSE2__)
+  __m128i x = _mm_loadu_si128((const __m128i *)of->rng);
+  __m128i low16 = _mm_set1_epi32(0xFFFF);
+  __m128 k = _mm_set1_ps(1.0f/65536), one = _mm_set1_ps(1.0f);
+  __m128 s = _mm_set1_ps(scale), vhi = _mm_set1_ps(hi), vlo = _mm_set1_ps(lo);
+
+  for (; i + 4 <= n; i += 4) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    __m128i sum = _mm_add_epi32(_mm_and_si128(x, low16), _mm_srli_epi32(x, 16));
+    __m128 d = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), k), one);
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), d);
+    v = _mm_min_ps(_mm_max_ps(v, vlo), vhi);
+    _mm_storeu_si128((__m128i *)(q + i), _mm_cvtps_epi32(v));
+  }
+  _mm_storeu_si128((__m128i *)of->rng, x);
+#else
+  for (; i + 4 <= n; i += 4) {
+    for (int l = 0; l < 4; l++) {
+      float v = in[i + l] * scale + tpdf(xorshift(&of->rng[l]));
+      v = v > hi ? hi : v < lo ? lo : v;
+      q[i + l] = (int32_t)lrintf(v);
+    }
+  }
+#endif
+
+  // Leftovers, on the first lanes
+  for (int l = 0; i < n; i++, l++) {
+    float v = in[i] * scale + tpdf(xorshift(&of->rng[l]));
+    v = v > hi ? hi : v < lo ? lo : v;
+    q[i] = (int32_t)lrintf(v);
+  }
+}
+
+static void quantize_shaped(OutFmt *of, const float *in, int32_t *q,
+  unsigned long n, float scale)
+{
+  /* As quantize(), with the error of earlier samples fed back. */
+  float hi = scale - 1, lo = -scale, v, e;
+  unsigned long i;
+  int c = 0;
+
+  for (i = 0; i < n; i++) {
+    float *err = of->err[c];
+    v = in[i] * scale - (SHAPE_B1 * err[0] + SHAPE_B2 * err[1]);
+    e = v + tpdf(xorshift(&of->rng[i & 3]));
+    e = e > hi ? hi : e < lo ? lo : e;
+    q[i] = (int32_t)lrintf(e);
+    // Clipping would feed back a huge error; keep it to dither size
+    e = q[i] - v;
+    e = e > 1.5f ? 1.5f : e < -1.5f ? -1.5f : e;
+    err[1] = err[0];
+    err[0] = e;
+    if (++c == NUM_CHAN)
+      c = 0;
+  }
+}
+
+size_t outfmt_convert(OutFmt *of, const float *in, void *out,
+  unsigned long frames)
+{
+  /* Converts frames of interleaved float into the output format.
+     Returns the number of bytes written to out. */
+  unsigned long n = frames * NUM_CHAN, m, i;
+  unsigned char *p = out;
+  int32_t q[QUANT_BLOCK];
+  float scale;
+
+  if (of->format == OUT_F32) {
+    memcpy(out, in, n * sizeof(float));
+    return n * sizeof(float);
+  }
+  scale = of->format == OUT_S16 ? 32768.0f : 8388608.0f;
+
+  // Blocks of whole frames, so the shaping stays on the right channel
+  for (; n > 0; n -= m, in += m) {
+    m = n < QUANT_BLOCK / NUM_CHAN * NUM_CHAN ? n : QUANT_BLOCK / NUM_CHAN * NUM_CHAN;
+    if (of->shape)
+      quantize_shaped(of, in, q, m, scale);
+    else
+      quantize(of, in, q, m, scale);
+    if (of->format == OUT_S16) {
+      int16_t *s = (int16_t *)p;
+      for (i = 0; i < m; i++)
+        s[i] = (int16_t)q[i];
+      p += m * 2;
+    } else {
+      for (i = 0; i < m; i++, p += 3) {
+        p[0] = q[i];
+        p[1] = q[i] >> 8;
+        p[2] = q[i] >> 16;
+      }
+    }
+  }
+  return p - (unsigned char *)out;
+}
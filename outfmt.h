@@ -0,0 +1,30 @@
+#ifndef _OUTFMT_H_
+#define _OUTFMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "synth.h"
+
+#define OUT_F32      1    // 32-bit float, passed through
+#define OUT_S16      2    // 16-bit PCM, TPDF dithered
+#define OUT_S24      3    // 24-bit PCM, TPDF dithered
+#define OUT_MAX_BYTES 4   // most bytes per sample of any format
+
+/* Conversion state of one output */
+typedef struct {
+  int format;                  // OUT_F32, OUT_S16 or OUT_S24
+  int shape;                   // 1 to push the dither noise up in frequency
+  uint32_t rng[4];             // four xorshift32 lanes for the dither
+  float err[NUM_CHAN][2];      // last two quantization errors per channel
+} OutFmt;
+
+/* outfmt.c function prototypes */
+int outfmt_parse(const char *name);
+void outfmt_init(OutFmt *of, int format, int shape);
+void outfmt_reset(OutFmt *of, unsigned long long seed);
+int outfmt_bits(int format);
+int outfmt_wav_format(int format);
+size_t outfmt_convert(OutFmt *of, const float *in, void *out,
+  unsigned long frames);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Recording what the sound card plays. The callback only copies each
+ * buffer into a FIFO; a writer thread converts it to the output format
+ * and writes it to the WAV file, so the audio thread never converts,
+ * touches the disk or waits. Each take, from r to r, goes to its own
+ * file: out.wav, then out_2.wav, out_3.wav and so on.
+ */
+
+#include <stdio.h>
+#include <string.h>  // for strrchr()
+#include <time.h>    // for nanosleep()
+#include "record.h"
+#include "wav.h"
+
+#define RECORD_BLOCK_FRAMES  (FRAMES_PER_BUFFER*4) // frames per write
+
+static int start_take(Recorder *rec, WavFile *wf)
+{
+  /* Opens the next take's file. */
+  char path[1024];
+  const char *dot = strrchr(rec->path, '.');
+  const char *slash = strrchr(rec->path, '/');
+  int format = rec->of.format;
+
+  if (++rec->takes == 1 || !dot || (slash && dot < slash))
+    snprintf(path, sizeof(path), rec->takes == 1 ? "%s" : "%s_%d",
+      rec->path, rec->takes);
+  else
+    snprintf(path, sizeof(path), "%.*s_%d%s", (int)(dot - rec->path),
+      rec->path, rec->takes, dot);
+  outfmt_reset(&rec->of, rec->takes);
+  return wav_create(wf, path, SAMP_RATE, NUM_CHAN, outfmt_bits(format),
+    outfmt_wav_format(format), -1);
+}
+
+static void *record_writer(void *arg)
+{
+  /* Drains the FIFO into the current take. A take ends once the
+     callback has cleared the flag and everything it pushed before
+     that has been written. */
+  Recorder *rec = arg;
+  float block[RECORD_BLOCK_FRAMES * NUM_CHAN];
+  unsigned char out[RECORD_BLOCK_FRAMES * NUM_CHAN * OUT_MAX_BYTES];
+  struct timespec nap = {0, (long)(1e9 * FRAMES_PER_BUFFER / SAMP_RATE / 2)};
+  WavFile wf;
+  int open = 0, failed = 0, running, on;
+  size_t n;
+
+  while (1) {
+    running = atomic_load(&rec->running);
+    on = atomic_load_explicit(&rec->on, memory_order_acquire);
+    n = fifo_avail(&rec->fifo);
+    if (n > 0) {
+      if (n > RECORD_BLOCK_FRAMES * NUM_CHAN)
+        n = RECORD_BLOCK_FRAMES * NUM_CHAN;
+      fifo_read(&rec->fifo, block, n);
+      if (!open && !failed) {
+        open = start_take(rec, &wf) == 0;
+        failed = !open;
+      }
+      outfmt_convert(&rec->of, block, out, n / NUM_CHAN);
+      if (!open || wav_write(&wf, out, n / NUM_CHAN) < 0)
+        atomic_fetch_add(&rec->dropped, n / NUM_CHAN);
+    } else if ((open || failed) && (!on || !running)) {
+      if (open && wav_close(&wf) < 0)
+        fprintf(stderr, "ERROR: could not finish recording %s\n", rec->path);
+      open = failed = 0;
+    } else if (!running) {
+      break;
+    } else {
+      nanosleep(&nap, NULL);
+    }
+  }
+  return NULL;
+}
+
+int recorder_start(Recorder *rec, const char *path, int format, int shape)
+{
+  /* Starts the writer thread. Nothing is written until the first
+     buffer comes in with the recording flag set. */
+  rec->path = path;
+  rec->takes = 0;
+  outfmt_init(&rec->of, format, shape);
+  atomic_init(&rec->on, 0);
+  atomic_init(&rec->dropped, 0);
+  atomic_init(&rec->running, 1);
+
+  if (fifo_init(&rec->fifo,
+      (size_t)RECORD_FIFO_SECONDS * SAMP_RATE * NUM_CHAN) < 0) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return -1;
+  }
+  if (pthread_create(&rec->thread, NULL, record_writer, rec) != 0) {
+    fprintf(stderr, "ERROR: could not start recording thread\n");
+    fifo_free(&rec->fifo);
+    return -1;
+  }
+  return 0;
+}
+
+void recorder_push(Recorder *rec, const float *output, unsigned long frames,
+  int on)
+{
+  /* Audio thread: queues the buffer if recording. Buffers go in whole
+     or not at all, and a full FIFO loses the buffer, never waits. The
+     flag is published after the samples, so the writer sees them
+     before it sees the take end. */
+  size_t n = frames * NUM_CHAN;
+
+  if (on) {
+    if (rec->fifo.size - fifo_avail(&rec->fifo) >= n)
+      fifo_write(&rec->fifo, output, n);
+    else
+      atomic_fetch_add_explicit(&rec->dropped, frames, memory_order_relaxed);
+  }
+  atomic_store_explicit(&rec->on, on, memory_order_release);
+}
+
+void recorder_stop(Recorder *rec)
+{
+  /* Writes out what is left, finishes the file and stops the writer;
+     call after the stream is stopped. */
+  atomic_store(&rec->running, 0);
+  pthread_join(rec->thread, NULL);
+  fifo_free(&rec->fifo);
+}
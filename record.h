@@ -0,0 +1,32 @@
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "synth.h"
+#include "fifo.h"
+#include "outfmt.h"
+
+#define RECORD_FIFO_SECONDS  2    // audio the writer may fall behind by
+#define RECORD_DEFAULT_PATH  "out.wav"
+
+/* Recorder: the callback hands its output over a FIFO to a writer
+   thread, which converts it and writes it to a WAV file */
+typedef struct {
+  Fifo fifo;
+  OutFmt of;                   // conversion state, writer thread only
+  const char *path;            // first take; later ones get _2, _3, ...
+  int takes;                   // files started so far
+  pthread_t thread;
+  atomic_int running;
+  atomic_int on;               // last recording flag the callback saw
+  atomic_long dropped;         // frames lost because the writer fell behind
+} Recorder;
+
+/* record.c function prototypes */
+int recorder_start(Recorder *rec, const char *path, int format, int shape);
+void recorder_push(Recorder *rec, const float *output, unsigned long frames,
+  int on);
+void recorder_stop(Recorder *rec);
+
+#endif
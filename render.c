@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include "render.h"
+
+void render_block(Synth *ps, Melody *pm, float *output, unsigned long frames)
+{
+  /* Renders frames of interleaved stereo audio for the melody,
+     advancing through the 16 steps and looping at the end.
+     This is the one render path shared by the PortAudio callback
+     and the offline/streaming modes. */
+  for (unsigned long i = 0; i < frames; i++) {
+    // Start of a step: play the new note if there is one
+      // (Otherwise let the previous note ring out)
+    if ((ps->samp_count == 0) && pm->freqs[ps->index_count])
+      play_note(ps, pm->freqs[ps->index_count]);
+
+    // Synthesize each frame. A sample instrument is read once per
+    // frame, so it plays at the note's pitch, and goes to both channels.
+    // The sine steps once per channel, which its pitch (48 is middle C)
+    // and envelope times have always been based on.
+    if (ps->tone.sample) {
+      output[2*i] = output[2*i + 1] = synth_sample(ps);
+    } else {
+      output[2*i] = synth_sample(ps);
+      output[2*i + 1] = synth_sample(ps);
+    }
+    // Increment sample count
+    ps->samp_count++;
+
+    /* If samp count reaches note duration */
+    if (ps->samp_count >= pm->note_duration) {
+      // Reset sample count
+      ps->samp_count = 0;
+      // Increment index count, looping melody at the end
+      ps->index_count++;
+      if (ps->index_count >= NUM_COLS)
+        ps->index_count = 0;
+    }
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include "synth.h"
+#include "melody.h"
+
+/* render.c function prototypes */
+void render_block(Synth *ps, Melody *pm, float *output, unsigned long frames);
+
+#endif
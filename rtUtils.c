@@ -0,0 +1,160 @@
+#define _GNU_SOURCE     // for pthread_setaffinity_np()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>     // for memset()
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>   // for mlockall()
+#ifdef __GLIBC__
+#include <malloc.h>     // for mallopt()
+#endif
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>  // for _mm_getcsr()
+#endif
+#include "rtUtils.h"
+
+/* initialize hardening options to "off" */
+void rt_init(RtConfig *rt)
+{
+    memset(rt, 0, sizeof(*rt));
+    rt->priority = RT_DEFAULT_PRIORITY;
+    rt->cpu = -1;
+    atomic_init(&rt->thread_done, 0);
+}
+
+/* lock and pre-fault memory; call before starting the stream */
+void rt_prepare_process(RtConfig *rt)
+{
+    char *p;
+
+    if (!rt->enabled)
+        return;
+
+    /* Lock everything mapped now and later so the audio thread
+       never waits on a page fault */
+    rt->mem_locked = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
+
+#ifdef __GLIBC__
+    /* Keep freed heap in the process instead of returning it, and
+       serve large allocations from the (now resident) heap */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    p = malloc(RT_PREFAULT_HEAP);
+    if (p) {
+        memset(p, 0, RT_PREFAULT_HEAP);
+        free(p);
+        rt->heap_touched = 1;
+    }
+#else
+    (void)p;
+#endif
+}
+
+/* set FTZ/DAZ so decaying envelopes never hit slow subnormal math */
+int rt_set_ftz_daz(void)
+{
+#if defined(__SSE__) || defined(__x86_64__)
+    /* bit 15 = flush to zero, bit 6 = denormals are zero */
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+    return (_mm_getcsr() & 0x8040) == 0x8040;
+#elif defined(__aarch64__)
+    unsigned long fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr |= (1UL << 24); /* FZ */
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    return (fpcr & (1UL << 24)) != 0;
+#else
+    return 0;
+#endif
+}
+
+/* prepare the calling thread; call once from the audio thread itself */
+void rt_prepare_thread(RtConfig *rt)
+{
+    struct sched_param param;
+    volatile char stack[RT_PREFAULT_STACK];
+
+    if (!rt->enabled || atomic_load(&rt->thread_done))
+        return;
+
+    /* Touch the stack we may grow into so it is resident (and locked) */
+    memset((char *)stack, 0, sizeof(stack));
+
+    rt->ftz_daz = rt_set_ftz_daz();
+
+    /* Real-time priority; needs CAP_SYS_NICE or an rtprio limit */
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = rt->priority;
+    rt->sched_fifo =
+        (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+
+#ifdef __linux__
+    if (rt->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(rt->cpu, &set);
+        rt->affinity =
+            (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+    }
+#endif
+
+    atomic_store(&rt->thread_done, 1);
+}
+
+/* harden a thread that renders for the audio thread; call from the
+   thread itself. It gets SCHED_FIFO at priority (if above 0), so the
+   audio thread can still preempt it, the given cpu (if 0 or more) and
+   FTZ/DAZ. Returns 0 if everything took effect. */
+int rt_prepare_worker(const RtConfig *rt, int priority, int cpu)
+{
+    struct sched_param param;
+    int ok;
+
+    if (!rt->enabled)
+        return 0;
+
+    ok = rt_set_ftz_daz();
+
+    if (priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        ok &= (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+    }
+
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ok &= (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+    }
+#endif
+
+    return ok ? 0 : -1;
+}
+
+/* describe what took effect, e.g. for the status line */
+int rt_report(RtConfig *rt, char *str, size_t len)
+{
+    char cpu_str[32];
+
+    if (!rt->enabled)
+        return snprintf(str, len, "RT hardening: off");
+    if (!atomic_load(&rt->thread_done))
+        return snprintf(str, len, "RT hardening: audio thread not started");
+
+    if (rt->cpu >= 0)
+        snprintf(cpu_str, sizeof(cpu_str), "cpu%d %s",
+            rt->cpu, rt->affinity ? "ok" : "FAILED");
+    else
+        snprintf(cpu_str, sizeof(cpu_str), "cpu any");
+
+    return snprintf(str, len,
+        "RT: fifo/%d %s, %s, mlock %s, heap %s, ftz/daz %s",
+        rt->priority, rt->sched_fifo ? "ok" : "FAILED",
+        cpu_str,
+        rt->mem_locked ? "ok" : "FAILED",
+        rt->heap_touched ? "ok" : "FAILED",
+        rt->ftz_daz ? "ok" : "FAILED");
+}
@@ -0,0 +1,34 @@
+#ifndef _RT_UTIL_H_
+#define _RT_UTIL_H_
+/* Real-time hardening utilities */
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RT_DEFAULT_PRIORITY  70        // SCHED_FIFO priority for the audio thread
+#define RT_PREFAULT_STACK    (256*1024) // bytes of audio thread stack to touch
+#define RT_PREFAULT_HEAP     (4*1024*1024) // bytes of heap to touch and keep
+
+typedef struct {
+  /* Requested settings */
+  int enabled;      // 1 = hardened mode requested
+  int priority;     // SCHED_FIFO priority for the audio thread
+  int cpu;          // CPU to pin the audio thread to, -1 = any
+
+  /* What actually took effect (1 = yes, 0 = no) */
+  int mem_locked;   // mlockall() succeeded
+  int heap_touched; // heap pre-faulted and trimming disabled
+  int sched_fifo;   // audio thread runs SCHED_FIFO
+  int affinity;     // audio thread pinned to cpu
+  int ftz_daz;      // flush-to-zero/denormals-are-zero on the audio thread
+  atomic_int thread_done; // set once rt_prepare_thread() has run
+} RtConfig;
+
+void rt_init(RtConfig *rt);
+void rt_prepare_process(RtConfig *rt);
+void rt_prepare_thread(RtConfig *rt);
+int rt_set_ftz_daz(void);
+int rt_prepare_worker(const RtConfig *rt, int priority, int cpu);
+int rt_report(RtConfig *rt, char *str, size_t len);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Sample-playback instrument. Each WAV file is mapped into memory
+ * read-only and played straight from the mapping: nothing is copied,
+ * and every voice that plays a sample reads the same pages. Loading
+ * faults every page in (and locks it if allowed), so the audio thread
+ * never waits on the disk the first time a sample plays. A sample's root note comes from the end of its
+ * file name, as a note number (piano_60.wav) or a note name
+ * (piano_C4.wav, piano_F#3.wav); without one it is SAMPLER_ROOT_NOTE.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>   // for qsort()
+#include <string.h>   // for strrchr()
+#include <ctype.h>    // for isdigit()
+#include <dirent.h>   // for reading a directory of samples
+#include <fcntl.h>    // for open()
+#include <unistd.h>   // for close(), sysconf()
+#include <sys/mman.h> // for mmap(), mlock()
+#include <sys/stat.h> // for stat()
+#include "sampler.h"
+#include "melody.h"
+#include "wav.h"
+
+static int root_note(const char *path)
+{
+  /* Reads the note number from the end of the file name. */
+  static const int steps[7] = {9, 11, 0, 2, 4, 5, 7}; // A..G from C
+  char name[256], *p, *end;
+  const char *base = strrchr(path, '/');
+  int note, octave;
+
+  snprintf(name, sizeof(name), "%s", base ? base + 1 : path);
+  if ((p = strrchr(name, '.')))
+    *p = '\0';
+  p = name + strlen(name);
+  while (p > name && p[-1] != '_' && p[-1] != '-' && p[-1] != ' ')
+    p--;
+
+  // Note number
+  if (isdigit((unsigned char)*p)) {
+    note = strtol(p, &end, 10);
+    return *end == '\0' && note > 0 && note < 128 ? note : SAMPLER_ROOT_NOTE;
+  }
+  // Note name: letter, optional # or s or b, octave (C4 = 60)
+  if (toupper((unsigned char)*p) < 'A' || toupper((unsigned char)*p) > 'G')
+    return SAMPLER_ROOT_NOTE;
+  note = steps[toupper((unsigned char)*p) - 'A'];
+  p++;
+  if (*p == '#' || *p == 's')
+    note++, p++;
+  else if (*p == 'b')
+    note--, p++;
+  octave = strtol(p, &end, 10);
+  if (end == p || *end != '\0')
+    return SAMPLER_ROOT_NOTE;
+  note += 12 * (octave + 1);
+  return note > 0 && note < 128 ? note : SAMPLER_ROOT_NOTE;
+}
+
+static int load_file(SamplePool *sp, const char *path)
+{
+  /* Maps one WAV file as the next zone. */
+  SampleZone *z = &sp->zones[sp->num_zones];
+  WavFile wf;
+  struct stat st;
+  int fd;
+
+  if (sp->num_zones >= SAMPLER_MAX_ZONES) {
+    fprintf(stderr, "WARNING: more than %d samples, skipping %s\n",
+      SAMPLER_MAX_ZONES, path);
+    return 0;
+  }
+  if (wav_open_read(&wf, path) < 0)
+    return -1;
+  wav_close(&wf);
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "ERROR: could not open %s\n", path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  z->map_len = st.st_size;
+  z->map = mmap(NULL, z->map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (z->map == MAP_FAILED) {
+    fprintf(stderr, "ERROR: could not map %s\n", path);
+    return -1;
+  }
+  /* Bring it all in now rather than on the audio thread. Locking
+     keeps it in; where RLIMIT_MEMLOCK doesn't allow that, touching
+     each page at least reads it in. */
+  madvise(z->map, z->map_len, MADV_WILLNEED);
+  if (mlock(z->map, z->map_len) < 0) {
+    long page = sysconf(_SC_PAGESIZE);
+    volatile const unsigned char *p = z->map;
+    for (size_t off = 0; off < z->map_len; off += page)
+      (void)p[off];
+  }
+
+  z->data = (const unsigned char *)z->map + wf.data_offset;
+  z->frames = wf.num_frames;
+  // A truncated file plays what it has
+  if (wf.data_offset + (long long)z->frames * wf.num_chan * (wf.bits/8) >
+      (long long)z->map_len)
+    z->frames = (z->map_len - wf.data_offset) / (wf.num_chan * (wf.bits/8));
+  z->num_chan = wf.num_chan;
+  z->bits = wf.bits;
+  z->format = wf.format;
+  z->rate = wf.samp_rate;
+  z->root = convert_to_freq(root_note(path));
+  sp->bytes += z->map_len;
+  sp->num_zones++;
+  return 0;
+}
+
+static int by_root(const void *a, const void *b)
+{
+  double ra = ((const SampleZone *)a)->root, rb = ((const SampleZone *)b)->root;
+  return (ra > rb) - (ra < rb);
+}
+
+int sampler_load(SamplePool *sp, const char *path)
+{
+  /* Loads one WAV file, or every .wav file in a directory, as an
+     instrument. Returns the number of samples, or -1 on error. */
+  struct stat st;
+
+  memset(sp, 0, sizeof(*sp));
+  if (stat(path, &st) < 0) {
+    fprintf(stderr, "ERROR: could not find %s\n", path);
+    return -1;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    DIR *d = opendir(path);
+    struct dirent *dir;
+    char file[1024];
+    size_t len;
+    if (!d) {
+      fprintf(stderr, "ERROR: could not open %s\n", path);
+      return -1;
+    }
+    while ((dir = readdir(d)) != NULL) {
+      len = strlen(dir->d_name);
+      if (len > 4 && strcmp(dir->d_name + len - 4, ".wav") == 0) {
+        snprintf(file, sizeof(file), "%s/%s", path, dir->d_name);
+        if (load_file(sp, file) < 0) {
+          closedir(d);
+          sampler_free(sp);
+          return -1;
+        }
+      }
+    }
+    closedir(d);
+  } else if (load_file(sp, path) < 0) {
+    return -1;
+  }
+
+  if (sp->num_zones == 0) {
+    fprintf(stderr, "ERROR: no samples in %s\n", path);
+    return -1;
+  }
+  qsort(sp->zones, sp->num_zones, sizeof(SampleZone), by_root);
+  return sp->num_zones;
+}
+
+const SampleZone *sampler_zone(const SamplePool *sp, double freq)
+{
+  /* The sample whose root is nearest freq, so it is shifted least. */
+  const SampleZone *best = &sp->zones[0];
+  double dist, best_dist = 0;
+
+  for (int i = 0; i < sp->num_zones; i++) {
+    const SampleZone *z = &sp->zones[i];
+    dist = z->root > freq ? z->root / freq : freq / z->root;
+    if (i == 0 || dist < best_dist) {
+      best = z;
+      best_dist = dist;
+    }
+  }
+  return best;
+}
+
+static float frame_at(const SampleZone *z, long i)
+{
+  /* One frame, mixed to mono; silence outside the sample. */
+  const unsigned char *p;
+  float v = 0;
+
+  if (i < 0 || i >= z->frames)
+    return 0;
+  p = z->data + (size_t)i * z->num_chan * (z->bits/8);
+  for (int c = 0; c < z->num_chan; c++) {
+    if (z->format == WAV_FMT_FLOAT) {
+      float f;
+      memcpy(&f, p, 4);
+      v += f;
+    } else if (z->bits == 16) {
+      short s;
+      memcpy(&s, p, 2);
+      v += s / 32768.0f;
+    } else if (z->bits == 24) {
+      int s24 = p[0] | (p[1] << 8) | (p[2] << 16);
+      v += ((s24 << 8) >> 8) / 8388608.0f; // sign-extend
+    } else {
+      int s;
+      memcpy(&s, p, 4);
+      v += s / 2147483648.0f;
+    }
+    p += z->bits/8;
+  }
+  return z->num_chan == 1 ? v : v / z->num_chan;
+}
+
+double sampler_read(const SampleZone *z, double pos, int interp)
+{
+  /* The sample's value at a fractional frame position. */
+  long i = (long)pos;
+  double t = pos - i;
+  double x0 = frame_at(z, i), x1 = frame_at(z, i + 1);
+
+  if (interp == SAMPLER_LINEAR)
+    return x0 + t * (x1 - x0);
+
+  // 4-point, 3rd-order Hermite (Catmull-Rom)
+  double xm1 = frame_at(z, i - 1), x2 = frame_at(z, i + 2);
+  double c1 = 0.5 * (x1 - xm1);
+  double c2 = xm1 - 2.5*x0 + 2*x1 - 0.5*x2;
+  double c3 = 0.5 * (x2 - xm1) + 1.5 * (x0 - x1);
+  return ((c3*t + c2)*t + c1)*t + x0;
+}
+
+void sampler_free(SamplePool *sp)
+{
+  for (int i = 0; i < sp->num_zones; i++)
+    munmap(sp->zones[i].map, sp->zones[i].map_len);
+  sp->num_zones = 0;
+  sp->bytes = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <stddef.h>
+
+#define SAMPLER_MAX_ZONES    128 // samples in one instrument
+#define SAMPLER_ROOT_NOTE    60  // note of a file whose name doesn't say (C4)
+#define SAMPLER_LINEAR       0   // 2-point interpolation, for live playback
+#define SAMPLER_CUBIC        1   // 4-point Hermite, for offline renders
+
+/* One sample, read straight out of its mapped file */
+typedef struct {
+  const unsigned char *data; // first frame, inside the mapping
+  long frames;               // length in frames
+  int num_chan;              // channels, mixed to mono as they are read
+  int bits;                  // 16, 24 or 32
+  int format;                // WAV_FMT_PCM or WAV_FMT_FLOAT
+  double rate;               // its sampling rate in Hz
+  double root;               // frequency it plays at unshifted, in Hz
+  void *map;                 // the whole file, page aligned
+  size_t map_len;
+} SampleZone;
+
+/* An instrument: samples at different pitches, shared by all voices */
+typedef struct SamplePool {
+  SampleZone zones[SAMPLER_MAX_ZONES]; // by root, low to high
+  int num_zones;
+  size_t bytes;              // mapped in all
+} SamplePool;
+
+/* sampler.c function prototypes */
+int sampler_load(SamplePool *sp, const char *path);
+const SampleZone *sampler_zone(const SamplePool *sp, double freq);
+double sampler_read(const SampleZone *z, double pos, int interp);
+void sampler_free(SamplePool *sp);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Reference reader for pentaseq's shared-memory output ring.
+ *
+ *   ./shmreader [-n /name] [-q] > out.raw
+ *
+ * Follows the ring pentaseq -m /name writes and copies the audio to
+ * stdout as raw interleaved 32-bit float, for a recorder or encoder to
+ * pick up. Once a second it reports on stderr how far behind the player
+ * it is and any audio lost because it fell more than a ring behind.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  // for atoi()
+#include <string.h>  // for strcmp()
+#include <time.h>    // for nanosleep()
+#include <unistd.h>  // for getopt(), write()
+#include <errno.h>
+#include "shmring.h"
+
+#define READ_FRAMES  4096  // most frames copied per read
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name = "/pentaseq";
+  static float buf[READ_FRAMES * 8];
+  ShmRing ring;
+  uint64_t t, next_report, frames = 0, lag_ns = 0;
+  struct timespec nap;
+  int quiet = 0, c;
+  long n;
+
+  while ((c = getopt(argc, argv, "n:q")) != -1) {
+    switch (c) {
+      case 'n':
+        name = optarg;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n /name] [-q] > out.raw\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (shm_ring_attach(&ring, name) < 0)
+    return 1;
+  if (ring.hdr->num_chan > 8) {
+    fprintf(stderr, "ERROR: %u channels is more than this reader takes\n",
+      ring.hdr->num_chan);
+    return 1;
+  }
+  fprintf(stderr, "%s: %u Hz, %u channels, ring of %u frames\n", name,
+    ring.hdr->samp_rate, ring.hdr->num_chan, ring.hdr->ring_frames);
+
+  // Poll about four times per block the player writes
+  nap.tv_sec = 0;
+  nap.tv_nsec = 250000000LL * ring.hdr->max_block / ring.hdr->samp_rate;
+  next_report = now_ns() + 1000000000ULL;
+
+  while ((n = shm_ring_read(&ring, buf, READ_FRAMES, &t)) >= 0) {
+    if (n == 0) {
+      nanosleep(&nap, NULL);
+    } else {
+      size_t bytes = n * ring.hdr->num_chan * sizeof(float);
+      const char *p = (const char *)buf;
+      while (bytes > 0) {
+        ssize_t w = write(STDOUT_FILENO, p, bytes);
+        if (w < 0 && errno == EINTR)
+          continue;
+        if (w <= 0)
+          goto done;
+        p += w;
+        bytes -= w;
+      }
+      frames += n;
+      lag_ns = now_ns() - t;
+    }
+
+    if (!quiet && now_ns() >= next_report) {
+      fprintf(stderr, "%llu frames, %.1f ms behind, %llu overruns "
+        "(%llu frames lost)\n", (unsigned long long)frames, lag_ns / 1e6,
+        (unsigned long long)ring.overruns, (unsigned long long)ring.skipped);
+      next_report = now_ns() + 1000000000ULL;
+    }
+  }
+  fprintf(stderr, "%s: player stopped\n", name);
+
+done:
+  shm_ring_close(&ring);
+  return 0;
+}
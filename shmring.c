@@ -0,0 +1,226 @@
+/*
+ * Shared-memory output ring; see shmring.h for the layout and the
+ * reading protocol. The writer side runs in the audio callback and
+ * never waits: it does not know whether anyone is reading.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>   // for memcpy()
+#include <time.h>     // for clock_gettime()
+#include <fcntl.h>    // for O_* constants
+#include <unistd.h>   // for ftruncate()
+#include <sys/mman.h> // for shm_open(), mmap()
+#include <sys/stat.h> // for fstat()
+#include "shmring.h"
+
+int shm_ring_create(ShmRing *r, const char *name, int samp_rate,
+  int num_chan, int max_block)
+{
+  /* Writer: creates the shared memory object. Fails if the name is
+     taken, rather than cutting off another player's readers. */
+  ShmRingHeader *h;
+  int fd;
+
+  memset(r, 0, sizeof(*r));
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->bytes = SHM_RING_HDR_BYTES +
+    (size_t)SHM_RING_FRAMES * num_chan * sizeof(float);
+  if (max_block > SHM_RING_FRAMES / 2)
+    max_block = SHM_RING_FRAMES / 2;
+
+  fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    fprintf(stderr, "ERROR: shared memory %s is in use by another pentaseq, "
+      "or left over from one that crashed (then remove /dev/shm%s)\n",
+      name, name);
+    return -1;
+  }
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: could not create shared memory %s\n", name);
+    return -1;
+  }
+  if (ftruncate(fd, r->bytes) < 0) {
+    fprintf(stderr, "ERROR: could not size shared memory %s\n", name);
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  r->hdr = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (r->hdr == MAP_FAILED) {
+    fprintf(stderr, "ERROR: could not map shared memory %s\n", name);
+    r->hdr = NULL;
+    shm_unlink(name);
+    return -1;
+  }
+  r->owner = 1;
+  r->data = (float *)((char *)r->hdr + SHM_RING_HDR_BYTES);
+  // Touch every page now so the callback never faults one in
+  memset(r->hdr, 0, r->bytes);
+
+  h = r->hdr;
+  h->version = SHM_RING_VERSION;
+  h->samp_rate = samp_rate;
+  h->num_chan = num_chan;
+  h->ring_frames = SHM_RING_FRAMES;
+  h->max_block = max_block;
+  h->data_offset = SHM_RING_HDR_BYTES;
+  atomic_init(&h->seq, 0);
+  atomic_init(&h->write_frame, 0);
+  atomic_init(&h->write_time_ns, 0);
+  atomic_init(&h->write_limit, 0);
+  atomic_init(&h->running, 1);
+  // Magic last, so a reader never sees a half-made header as valid
+  atomic_thread_fence(memory_order_release);
+  h->magic = SHM_RING_MAGIC;
+  return 0;
+}
+
+void shm_ring_write(ShmRing *r, const float *data, unsigned long frames)
+{
+  /* Writer (audio thread): appends frames, overwriting the oldest. */
+  ShmRingHeader *h = r->hdr;
+  unsigned long mask = h->ring_frames - 1, n, start, first;
+  uint64_t w = atomic_load_explicit(&h->write_frame, memory_order_relaxed);
+  unsigned int seq;
+  struct timespec ts;
+
+  while (frames > 0) {
+    n = frames < h->max_block ? frames : h->max_block;
+    start = w & mask;
+    first = n < h->ring_frames - start ? n : h->ring_frames - start;
+    // Claim the frames before overwriting them, so a reader still
+    // copying the old ones finds out
+    atomic_store_explicit(&h->write_limit, w + n, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(r->data + start * h->num_chan, data,
+      first * h->num_chan * sizeof(float));
+    memcpy(r->data, data + first * h->num_chan,
+      (n - first) * h->num_chan * sizeof(float));
+    w += n;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    // Publish the new end and its time together
+    seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&h->write_frame, w, memory_order_relaxed);
+    atomic_store_explicit(&h->write_time_ns,
+      (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, seq + 2, memory_order_release);
+
+    data += n * h->num_chan;
+    frames -= n;
+  }
+}
+
+int shm_ring_attach(ShmRing *r, const char *name)
+{
+  /* Reader: maps the ring read-only and starts at the newest frame. */
+  struct stat st;
+  int fd;
+
+  memset(r, 0, sizeof(*r));
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: no shared memory %s (is pentaseq running?)\n",
+      name);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < SHM_RING_HDR_BYTES) {
+    fprintf(stderr, "ERROR: %s is not a pentaseq ring\n", name);
+    close(fd);
+    return -1;
+  }
+  r->bytes = st.st_size;
+  r->hdr = mmap(NULL, r->bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (r->hdr == MAP_FAILED) {
+    fprintf(stderr, "ERROR: could not map shared memory %s\n", name);
+    r->hdr = NULL;
+    return -1;
+  }
+  if (r->hdr->magic != SHM_RING_MAGIC || r->hdr->version != SHM_RING_VERSION ||
+      r->hdr->data_offset + (size_t)r->hdr->ring_frames * r->hdr->num_chan *
+      sizeof(float) > r->bytes) {
+    fprintf(stderr, "ERROR: %s is not a pentaseq ring\n", name);
+    shm_ring_close(r);
+    return -1;
+  }
+  r->data = (float *)((char *)r->hdr + r->hdr->data_offset);
+  r->read_frame = atomic_load_explicit(&r->hdr->write_frame,
+    memory_order_acquire);
+  return 0;
+}
+
+long shm_ring_read(ShmRing *r, float *data, unsigned long frames,
+  uint64_t *time_ns)
+{
+  /* Reader: copies up to frames frames that are ready, and returns how
+     many (0 if none yet, -1 once the writer has stopped and everything
+     is read). time_ns gets the CLOCK_MONOTONIC time the first of them
+     was written. If the writer has lapped the reader, it skips ahead. */
+  const ShmRingHeader *h = r->hdr;
+  unsigned long ring = h->ring_frames, chan = h->num_chan, n, start, first;
+  uint64_t w, l, t, oldest;
+  unsigned int s1, s2;
+
+  for (;;) {
+    do {
+      s1 = atomic_load_explicit(&h->seq, memory_order_acquire);
+      w = atomic_load_explicit(&h->write_frame, memory_order_relaxed);
+      t = atomic_load_explicit(&h->write_time_ns, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      s2 = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+
+    // Frames older than this may be overwritten while we copy them
+    oldest = w + h->max_block > ring ? w + h->max_block - ring : 0;
+    if (r->read_frame < oldest) {
+      // Overrun: drop to half a ring behind the writer
+      uint64_t to = w > ring/2 ? w - ring/2 : 0;
+      if (to < oldest)
+        to = oldest;
+      r->skipped += to - r->read_frame;
+      r->overruns++;
+      r->read_frame = to;
+    }
+
+    n = w - r->read_frame;
+    if (n > frames)
+      n = frames;
+    if (n == 0)
+      return atomic_load(&h->running) ? 0 : -1;
+
+    start = r->read_frame & (ring - 1);
+    first = n < ring - start ? n : ring - start;
+    memcpy(data, r->data + start * chan, first * chan * sizeof(float));
+    memcpy(data + first * chan, r->data, (n - first) * chan * sizeof(float));
+
+    // Check the writer didn't reach what we copied while we copied it
+    atomic_thread_fence(memory_order_acquire);
+    l = atomic_load_explicit(&h->write_limit, memory_order_relaxed);
+    if (r->read_frame + ring >= l)
+      break;
+  }
+
+  if (time_ns)
+    *time_ns = t - (w - r->read_frame) * 1000000000ULL / h->samp_rate;
+  r->read_frame += n;
+  return n;
+}
+
+void shm_ring_close(ShmRing *r)
+{
+  if (!r->hdr)
+    return;
+  if (r->owner) {
+    // Tell readers no more is coming, then remove the name
+    atomic_store(&r->hdr->running, 0);
+    shm_unlink(r->name);
+  }
+  munmap(r->hdr, r->bytes);
+  r->hdr = NULL;
+}
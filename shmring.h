@@ -0,0 +1,82 @@
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Shared-memory output ring. The player writes every block the audio
+ * callback produces into a POSIX shared memory object; other processes
+ * map it read-only and follow along. The player never waits for them.
+ *
+ * Layout of the object (all integers little-endian, native width):
+ *
+ *   offset 0            ShmRingHeader, below
+ *   offset data_offset  ring_frames frames of interleaved float32
+ *                       samples, num_chan per frame
+ *
+ * Frame f of the stream (counting from 0 since the player started)
+ * sits at ring index f % ring_frames. For each block of at most
+ * max_block frames, the writer first advances write_limit past it, then
+ * copies it into the ring, then advances write_frame to match. A
+ * reader therefore:
+ *
+ *   1. loads write_frame (acquire) as w; frames [r, w) are ready;
+ *   2. copies frames from its position r up to w;
+ *   3. issues an acquire fence and loads write_limit as l. The copy is
+ *      good only if r >= l - ring_frames. Otherwise the writer may have
+ *      overwritten part of it: the reader has overrun and should skip
+ *      to a newer position, like l - ring_frames or w.
+ *
+ * The writer has a release fence between publishing write_limit and
+ * copying the block, so this holds on weakly ordered CPUs too, not only
+ * on x86.
+ *
+ * write_time_ns is the CLOCK_MONOTONIC time at which the block ending at
+ * write_frame was written. To read the pair consistently, read seq,
+ * then both, then seq again, and retry if seq changed or is odd.
+ * While the player runs, running is 1; it is 0 once it has stopped.
+ */
+
+#define SHM_RING_MAGIC      0x52485350u // "PSHR"
+#define SHM_RING_VERSION    2
+#define SHM_RING_FRAMES     (1 << 16) // about 1.4 s at 48 kHz
+#define SHM_RING_HDR_BYTES  4096      // header, padded to a page
+
+typedef struct {
+  uint32_t magic;              // SHM_RING_MAGIC
+  uint32_t version;            // SHM_RING_VERSION
+  uint32_t samp_rate;          // frames per second
+  uint32_t num_chan;           // samples per frame
+  uint32_t ring_frames;        // ring capacity in frames, a power of two
+  uint32_t max_block;          // most frames written at once
+  uint32_t data_offset;        // bytes from the start to the samples
+  atomic_uint running;         // 1 while the player is writing
+  _Alignas(64) atomic_uint seq;          // odd while the pair below changes
+  _Atomic uint64_t write_frame;          // frames written since the start
+  _Atomic uint64_t write_time_ns;        // CLOCK_MONOTONIC at write_frame
+  _Alignas(64) _Atomic uint64_t write_limit; // end of what may be written
+} ShmRingHeader;
+
+/* One side's mapping of the ring */
+typedef struct {
+  ShmRingHeader *hdr;
+  float *data;
+  size_t bytes;                // size of the mapping
+  char name[64];               // shared memory object name
+  int owner;                   // 1 for the writer, which unlinks it
+  uint64_t read_frame;         // reader: next frame to read
+  uint64_t overruns;           // reader: times it fell behind
+  uint64_t skipped;            // reader: frames lost to overruns
+} ShmRing;
+
+/* shmring.c function prototypes */
+int shm_ring_create(ShmRing *r, const char *name, int samp_rate,
+  int num_chan, int max_block);
+void shm_ring_write(ShmRing *r, const float *data, unsigned long frames);
+int shm_ring_attach(ShmRing *r, const char *name);
+long shm_ring_read(ShmRing *r, float *data, unsigned long frames,
+  uint64_t *time_ns);
+void shm_ring_close(ShmRing *r);
+
+#endif
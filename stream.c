@@ -0,0 +1,148 @@
+#define _GNU_SOURCE     // for F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for strcmp(), memset()
+#include <errno.h>
+#include <signal.h>
+#include <time.h>    // for clock_nanosleep()
+#include <fcntl.h>
+#include <unistd.h>  // for write()
+#include "stream.h"
+#include "render.h"
+#include "outfmt.h"
+
+static volatile sig_atomic_t stop_stream = 0;
+
+static void handle_stop(int sig)
+{
+  (void)sig;
+  stop_stream = 1;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+  /* Writes the whole block, blocking while the consumer catches up.
+     This is the backpressure: a slow reader slows the render down
+     instead of audio being dropped. */
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR && !stop_stream)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int stream_pcm(Control *ctl, LoopCache *lc, Synth *ps, Melody *pm,
+  const char *path, int format, int shape, int realtime, double seconds)
+{
+  /* Streams the melody as raw interleaved PCM to stdout ("-") or
+     a file/named FIFO until interrupted, the reader goes away,
+     or the requested number of seconds has been written. format
+     and shape are as in outfmt.h. */
+  unsigned long block_frames, frames;
+  long long frames_left;
+  float *fbuf;
+  void *obuf;
+  size_t bytes;
+  OutFmt of;
+  struct sigaction sa;
+  struct timespec deadline, now;
+  int fd, ret = 0;
+
+  // In real-time mode write one device buffer at a time to keep latency low
+  block_frames = realtime ? FRAMES_PER_BUFFER : STREAM_BLOCK_FRAMES;
+  frames_left = seconds > 0 ? (long long)(seconds * ps->samp_rate) : -1;
+
+  if (strcmp(path, "-") == 0)
+    fd = STDOUT_FILENO;
+  else if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "ERROR: could not open %s for streaming\n", path);
+    return -1;
+  }
+
+#ifdef F_SETPIPE_SZ
+  // Let a pipe or FIFO hold a whole block so each write is a single copy
+  fcntl(fd, F_SETPIPE_SZ, (int)(block_frames * NUM_CHAN * sizeof(float)));
+#endif
+
+  outfmt_init(&of, format, shape);
+  fbuf = malloc(block_frames * NUM_CHAN * sizeof(float));
+  obuf = malloc(block_frames * NUM_CHAN * OUT_MAX_BYTES);
+  if (!fbuf || !obuf) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    ret = -1;
+    goto done;
+  }
+
+  // Write errors are handled through EPIPE rather than a signal
+  signal(SIGPIPE, SIG_IGN);
+  /* No SA_RESTART (which signal() sets), so Ctrl-C interrupts a write
+     blocked on a full pipe instead of waiting for the reader */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (!stop_stream && frames_left != 0) {
+    frames = block_frames;
+    if (frames_left > 0 && frames_left < (long long)frames)
+      frames = frames_left;
+
+    control_render(ctl, lc, NULL, ps, pm, fbuf, frames);
+
+    // Float goes out as rendered; PCM is dithered on the way
+    if (format == OUT_F32)
+      ret = write_all(fd, fbuf, frames * NUM_CHAN * sizeof(float));
+    else {
+      bytes = outfmt_convert(&of, fbuf, obuf, frames);
+      ret = write_all(fd, obuf, bytes);
+    }
+    if (ret < 0) {
+      // Reader closed the pipe: a normal way to end the stream
+      if (errno == EPIPE || stop_stream)
+        ret = 0;
+      else
+        fprintf(stderr, "ERROR: stream write failed\n");
+      break;
+    }
+
+    if (frames_left > 0)
+      frames_left -= frames;
+
+    if (realtime) {
+      /* Sleep until this block's wall-clock deadline. If a slow reader
+         held us back by more than a block, restart the clock instead
+         of bursting to catch up. */
+      deadline.tv_nsec += (long)(1e9 * frames / ps->samp_rate);
+      while (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - deadline.tv_sec) * 1e9 +
+          (now.tv_nsec - deadline.tv_nsec) > 1e9 * frames / ps->samp_rate)
+        deadline = now;
+      else
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+            &deadline, NULL) == EINTR && !stop_stream)
+          ;
+    }
+  }
+
+done:
+  free(fbuf);
+  free(obuf);
+  if (fd != STDOUT_FILENO)
+    close(fd);
+  return ret;
+}
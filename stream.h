@@ -0,0 +1,15 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include "synth.h"
+#include "melody.h"
+#include "loopcache.h"
+#include "control.h"
+
+#define STREAM_BLOCK_FRAMES  (FRAMES_PER_BUFFER*8) // frames per write
+
+/* stream.c function prototypes */
+int stream_pcm(Control *ctl, LoopCache *lc, Synth *ps, Melody *pm, const char *path, int format,
+  int shape, int realtime, double seconds);
+
+#endif
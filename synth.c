@@ -13,8 +13,16 @@ void play_note(Synth *ps, double freq)
 
   fs = ps->samp_rate;
 
+  freq *= ps->pitch_ratio;
   pt->f0 = freq;
-  pt->phase_inc = 2*PI*freq/fs;
+  if (ps->samples) {
+    // Play the nearest sample, resampled to the note's pitch
+    pt->sample = sampler_zone(ps->samples, freq);
+    pt->phase_inc = freq / pt->sample->root * pt->sample->rate / fs;
+  } else {
+    pt->sample = NULL;
+    pt->phase_inc = 2*PI*freq/fs;
+  }
   pt->phase = 0.0;
   pt->attack_factor = ATTACK_FACTOR;
   pt->decay_factor = DECAY_FACTOR;
@@ -23,6 +31,9 @@ void play_note(Synth *ps, double freq)
   //pt->decay_factor = note_duration_decay_factor;
   pt->attack_amp = 1.0;
   pt->decay_amp = 1.0;
+  // Samples bring their own attack
+  if (pt->sample)
+    pt->attack_amp = 0.0;
 }
 
 double synth_sample(Synth *ps)
@@ -36,7 +47,10 @@ double synth_sample(Synth *ps)
 
     if ( pt->phase_inc > -1 ) {
       // Compute sample value
-      v += FS_AMPL * sin(pt->phase);
+      if (pt->sample)
+        v += FS_AMPL * sampler_read(pt->sample, pt->phase, ps->interp);
+      else
+        v += FS_AMPL * sin(pt->phase);
 
       // Implement attack and decay
       v *= (1 - pt->attack_amp);
@@ -45,6 +59,9 @@ double synth_sample(Synth *ps)
       pt->decay_amp *= pt->decay_factor;
       // Increment phase
       pt->phase += pt->phase_inc;
+      // A sample stops at its end
+      if (pt->sample && pt->phase >= pt->sample->frames)
+        pt->phase_inc = -1;
     }
 
     // Stop playout if below drop level
@@ -2,6 +2,7 @@
 #define _SYNTH_H_
 
 #include "melody.h"
+#include "sampler.h"
 
 /* write output to wav file for debugging */
 //#define DB_WAV_OUT          1
@@ -23,6 +24,8 @@ typedef struct {
     double f0; /* frequency associated with key */
     double phase_inc; /* phase increment per sample to realize freq */
     double phase; /* save phase value for next sample */
+    const SampleZone *sample; /* sample played, or NULL for the sine;
+                                 phase and phase_inc are then in frames */
     double attack_factor;
     double decay_factor;
     double attack_amp; /* save attack amplitude for next sample */
@@ -33,8 +36,10 @@ typedef struct {
     int samp_rate;   // sampling rate of output
     int samp_count;  // count samples, reset every note
     int index_count; // count indexes i.e. notes
+    double pitch_ratio; // transposition applied to every new note
+    const SamplePool *samples; // sample instrument, or NULL for the sine
+    int interp;      // SAMPLER_LINEAR or SAMPLER_CUBIC for samples
     Tone tone;       // tone that plays the notes
-    double output[FRAMES_PER_BUFFER];
 } Synth;
 
 /* function prototypes */
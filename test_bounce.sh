@@ -0,0 +1,34 @@
+#!/bin/sh
+# Renders a melody with -b -k at several thread counts and formats. -k
+# renders it again on one thread and fails unless the two match, and
+# every thread count must give the same file. Run after ./build.sh.
+#   ./test_bounce.sh [melody.txt] [seconds]
+mel=${1:-apple.txt}
+secs=${2:-20}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+for fmt in f32 s16 s24 "s16 -S" "s24 -S"; do
+  ref=
+  for j in 1 3 16; do
+    out="$tmp/out.wav"
+    if ! ./pentaseq -b -k -d "$secs" -j $j -f $fmt -o "$out" "$mel" \
+        2>"$tmp/log"; then
+      cat "$tmp/log"
+      echo "FAIL: -f $fmt -j $j"
+      fail=1
+      continue
+    fi
+    sum=$(cksum <"$out")
+    if [ -z "$ref" ]; then
+      ref=$sum
+    elif [ "$sum" != "$ref" ]; then
+      echo "FAIL: -f $fmt -j $j differs from -j 1"
+      fail=1
+      continue
+    fi
+    echo "ok: -f $fmt -j $j"
+  done
+done
+exit $fail
@@ -0,0 +1,284 @@
+/*
+ * Extra tracks: melodies that play alongside the main one, each with
+ * its own synth, rendered in parallel by a small pool of workers.
+ *
+ * At each block the render thread splits the tracks into one range per
+ * worker, bumps `generation` and posts the semaphore of any worker that
+ * went to sleep. Every thread (the render thread included) renders the
+ * tracks of its own range into its own mix buffer, then steals unclaimed
+ * tracks from the other ranges. The render thread waits until every
+ * track has been rendered, not for every worker: a worker that is slow
+ * to wake just finds nothing left to claim. Then it adds up the mix
+ * buffers. Nothing here locks or allocates.
+ */
+
+#define _GNU_SOURCE      // for pthread_setaffinity_np()
+#include <stdio.h>
+#include <stdlib.h>      // for malloc()
+#include <string.h>      // for memset()
+#include <sched.h>
+#include <unistd.h>      // for sysconf()
+#include "tracks.h"
+#include "render.h"
+#include "rtUtils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>   // for _mm_pause()
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+static int claim(TrackWorker *w)
+{
+  /* Takes the next unrendered track of a range, or -1. The track and
+     the end come from the same word, so they belong to the same block.
+     Acquire pairs with the render thread opening the range, so frames
+     is that block's even for a worker that woke late. */
+  unsigned long long r = atomic_fetch_add_explicit(&w->range, 1,
+    memory_order_acquire);
+  unsigned int i = (unsigned int)r;
+  return i < (unsigned int)(r >> 32) ? (int)i : -1;
+}
+
+static void run_share(TrackPool *tp, int id)
+{
+  /* Renders this worker's range, then steals from the others. */
+  TrackWorker *me = &tp->workers[id];
+  unsigned long frames, n;
+  int total = tp->num_workers + 1, i, t;
+
+  for (i = 0; i < total; i++) {
+    TrackWorker *from = &tp->workers[(id + i) % total];
+    while ((t = claim(from)) >= 0) {
+      Track *tr = &tp->tracks[t];
+      frames = tp->frames;
+      n = frames * NUM_CHAN;
+      render_block(&tr->synth, &tr->melody, me->tmp, frames);
+      if (!me->touched) {
+        memcpy(me->mix, me->tmp, n * sizeof(float));
+        me->touched = 1;
+      } else {
+        for (unsigned long k = 0; k < n; k++)
+          me->mix[k] += me->tmp[k];
+      }
+      atomic_fetch_add_explicit(&tp->finished, 1, memory_order_release);
+    }
+  }
+}
+
+static void *track_worker(void *arg)
+{
+  /* Waits for a new generation and renders what it can claim.
+     Spins for a while first, since the next block is usually close. */
+  TrackWorker *me = arg;
+  TrackPool *tp = me->pool;
+  unsigned int seen, g;
+  int spins = 0;
+
+#ifdef __linux__
+  if (me->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(me->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+  /* With -R, SCHED_FIFO just below the audio thread, which waits on
+     these tracks: at normal priority they could be preempted while
+     it spins */
+  if (tp->rt)
+    rt_prepare_worker(tp->rt, tp->rt->priority - 1, -1);
+
+  // Generation 0 is before the first block, even if we start late
+  seen = 0;
+  while (atomic_load_explicit(&tp->running, memory_order_relaxed)) {
+    g = atomic_load_explicit(&tp->generation, memory_order_acquire);
+    if (g == seen) {
+      if (++spins < TRACKS_SPIN) {
+        cpu_relax();
+        continue;
+      }
+      /* Sleep, unless a block started while we were deciding to */
+      atomic_store(&me->asleep, 1);
+      if (atomic_load(&tp->generation) != seen &&
+          atomic_exchange(&me->asleep, 0) == 1) {
+        spins = 0;
+        continue;
+      }
+      sem_wait(&me->wake);
+      spins = 0;
+      continue;
+    }
+    seen = g;
+    spins = 0;
+    run_share(tp, me->id);
+  }
+  return NULL;
+}
+
+int tracks_start(TrackPool *tp, int num_workers, int first_cpu,
+  const RtConfig *rt)
+{
+  /* Allocates buffers and starts num_workers threads, pinned to
+     consecutive CPUs from first_cpu (if it is 0 or more). */
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  memset(tp, 0, sizeof(*tp));
+  if (num_workers > TRACKS_MAX_WORKERS)
+    num_workers = TRACKS_MAX_WORKERS;
+  if (num_workers < 0)
+    num_workers = 0;
+  tp->num_workers = num_workers;
+  tp->rt = rt;
+  atomic_init(&tp->num_tracks, 0);
+  atomic_init(&tp->generation, 0);
+  atomic_init(&tp->finished, 0);
+  atomic_init(&tp->blocks, 0);
+  atomic_init(&tp->running, 1);
+
+  for (int i = 0; i <= num_workers; i++) {
+    TrackWorker *w = &tp->workers[i];
+    w->mix = malloc(FRAMES_PER_BUFFER * NUM_CHAN * sizeof(float));
+    w->tmp = malloc(FRAMES_PER_BUFFER * NUM_CHAN * sizeof(float));
+    if (!w->mix || !w->tmp) {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return -1;
+    }
+    atomic_init(&w->range, 0);
+    atomic_init(&w->asleep, 0);
+    w->id = i;
+    w->pool = tp;
+    w->cpu = first_cpu >= 0 && i > 0 ? (first_cpu + i - 1) % ncpu : -1;
+  }
+  for (int i = 1; i <= num_workers; i++) {
+    TrackWorker *w = &tp->workers[i];
+    sem_init(&w->wake, 0, 0);
+    if (pthread_create(&w->thread, NULL, track_worker, w) != 0) {
+      fprintf(stderr, "ERROR: could not start track worker\n");
+      tp->num_workers = i - 1;
+      break;
+    }
+  }
+  return 0;
+}
+
+int tracks_add(TrackPool *tp, Melody *pm)
+{
+  /* UI thread: starts playing a copy of the melody as a new track. */
+  int n = atomic_load(&tp->num_tracks);
+  Track *tr;
+
+  if (n >= MAX_TRACKS || pm->note_duration <= 0)
+    return -1;
+  tr = &tp->tracks[n];
+  memset(tr, 0, sizeof(*tr));
+  tr->melody = *pm;
+  tr->melody.filename = NULL;
+  tr->synth.samp_rate = SAMP_RATE;
+  tr->synth.pitch_ratio = 1.0;
+  tr->synth.samples = tp->samples;
+  tr->synth.interp = SAMPLER_LINEAR;
+  tr->synth.tone.phase_inc = -1; // Silent until the first note
+  // Publish the track only once it is complete
+  atomic_store_explicit(&tp->num_tracks, n + 1, memory_order_release);
+  return n + 1;
+}
+
+void tracks_clear(TrackPool *tp)
+{
+  /* UI thread: stops all tracks, and waits for any block in progress
+     to finish with them so their slots can be reused. */
+  unsigned int g;
+
+  atomic_store(&tp->num_tracks, 0);
+  g = atomic_load(&tp->blocks);
+  for (int i = 0; i < 100 && atomic_load(&tp->blocks) - g < 2; i++)
+    usleep(1000);
+}
+
+static void render_chunk(TrackPool *tp, int num_tracks, float *output,
+  unsigned long frames)
+{
+  unsigned long n = frames * NUM_CHAN;
+  int total, per, t;
+
+  /* Small jobs: render here rather than pay for waking the workers */
+  if (num_tracks < TRACKS_MIN_PARALLEL || tp->num_workers == 0) {
+    TrackWorker *me = &tp->workers[0];
+    for (t = 0; t < num_tracks; t++) {
+      Track *tr = &tp->tracks[t];
+      render_block(&tr->synth, &tr->melody, me->tmp, frames);
+      for (unsigned long k = 0; k < n; k++)
+        output[k] += me->tmp[k];
+    }
+    return;
+  }
+
+  /* Give each thread a contiguous range, so tracks tend to stay on
+     the same core from block to block. Everything a worker reads is
+     set before its range opens (the release store of range). */
+  total = tp->num_workers + 1;
+  per = (num_tracks + total - 1) / total;
+  tp->frames = frames;
+  atomic_store_explicit(&tp->finished, 0, memory_order_relaxed);
+  for (int i = 0; i < total; i++) {
+    int start = i * per < num_tracks ? i * per : num_tracks;
+    tp->workers[i].touched = 0;
+    int end = start + per < num_tracks ? start + per : num_tracks;
+    atomic_store_explicit(&tp->workers[i].range,
+      (unsigned long long)end << 32 | (unsigned int)start,
+      memory_order_release);
+  }
+  atomic_fetch_add_explicit(&tp->generation, 1, memory_order_release);
+  for (int i = 1; i < total; i++)
+    if (atomic_exchange(&tp->workers[i].asleep, 0) == 1)
+      sem_post(&tp->workers[i].wake);
+
+  run_share(tp, 0);
+  while (atomic_load_explicit(&tp->finished, memory_order_acquire) < num_tracks)
+    cpu_relax();
+
+  /* Reduce */
+  for (int i = 0; i < total; i++) {
+    TrackWorker *w = &tp->workers[i];
+    if (!w->touched)
+      continue;
+    for (unsigned long k = 0; k < n; k++)
+      output[k] += w->mix[k];
+  }
+}
+
+void tracks_render(TrackPool *tp, float *output, unsigned long frames)
+{
+  /* Render thread: adds all tracks into output. */
+  int num_tracks;
+  unsigned long n;
+
+  if (!tp)
+    return;
+  num_tracks = atomic_load_explicit(&tp->num_tracks, memory_order_acquire);
+  // Count the block even with no tracks: tracks_clear() waits on it
+  while (num_tracks > 0 && frames > 0) {
+    n = frames < FRAMES_PER_BUFFER ? frames : FRAMES_PER_BUFFER;
+    render_chunk(tp, num_tracks, output, n);
+    output += n * NUM_CHAN;
+    frames -= n;
+  }
+  atomic_fetch_add_explicit(&tp->blocks, 1, memory_order_release);
+}
+
+void tracks_stop(TrackPool *tp)
+{
+  /* Stops the workers; call after the stream is stopped. */
+  atomic_store(&tp->running, 0);
+  for (int i = 1; i <= tp->num_workers; i++) {
+    sem_post(&tp->workers[i].wake);
+    pthread_join(tp->workers[i].thread, NULL);
+    sem_destroy(&tp->workers[i].wake);
+  }
+  for (int i = 0; i <= tp->num_workers; i++) {
+    free(tp->workers[i].mix);
+    free(tp->workers[i].tmp);
+  }
+}
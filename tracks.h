@@ -0,0 +1,65 @@
+#ifndef _TRACKS_H_
+#define _TRACKS_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "synth.h"
+#include "melody.h"
+#include "rtUtils.h"
+
+#define MAX_TRACKS          1024 // extra melodies playing alongside the main one
+#define TRACKS_MAX_WORKERS  16  // worker threads besides the render thread
+#define TRACKS_MIN_PARALLEL 4   // fewer tracks than this render on one thread
+#define TRACKS_SPIN         20000 // polls before an idle worker sleeps
+
+/* An extra melody with its own synth */
+typedef struct {
+  Synth synth;
+  Melody melody;
+} Track;
+
+struct TrackPool;
+
+/* A worker's share of one block */
+typedef struct {
+  _Alignas(64) atomic_ullong range; // end of this worker's range in the
+                                 // high 32 bits, next track to claim in
+                                 // the low 32: one word, so a claim
+                                 // never mixes two blocks' ranges
+  float *mix;                    // tracks this worker rendered, summed
+  float *tmp;                    // one track's block
+  int touched;                   // mix holds audio for this block (reset
+                                 // by the render thread at each block)
+  atomic_int asleep;             // 1 while waiting on wake
+  sem_t wake;
+  pthread_t thread;
+  int cpu;                       // CPU pinned to, -1 = any
+  int id;                        // index in the workers array
+  struct TrackPool *pool;
+} TrackWorker;
+
+typedef struct TrackPool {
+  Track tracks[MAX_TRACKS];
+  atomic_int num_tracks;         // tracks[0..num_tracks) are playing
+  const SamplePool *samples;     // instrument for new tracks, NULL = sine
+
+  int num_workers;               // threads besides the render thread
+  const RtConfig *rt;            // -R settings for the workers, or NULL
+  TrackWorker workers[TRACKS_MAX_WORKERS + 1]; // [0] is the render thread
+  unsigned long frames;          // length of the current block
+  _Alignas(64) atomic_uint generation; // bumped to start a block
+  _Alignas(64) atomic_int finished; // tracks of the block rendered
+  atomic_uint blocks;            // blocks rendered, for tracks_clear()
+  atomic_int running;
+} TrackPool;
+
+/* tracks.c function prototypes */
+int tracks_start(TrackPool *tp, int num_workers, int first_cpu,
+  const RtConfig *rt);
+int tracks_add(TrackPool *tp, Melody *pm);
+void tracks_clear(TrackPool *tp);
+void tracks_render(TrackPool *tp, float *output, unsigned long frames);
+void tracks_stop(TrackPool *tp);
+
+#endif
@@ -0,0 +1,518 @@
+/*
+ * Offline transcription of a WAV recording into pentaseq melodies.
+ *
+ * Pass 1 finds onsets and their pitches, and only keeps running sums:
+ * a pitch class profile, a note histogram, and for each candidate step
+ * rate the phase of the onsets against that grid. From these we pick
+ * the step rate (tempo), grid offset, root and scale.
+ * Pass 2 walks the recording one 16-step bar at a time, marks the steps
+ * that start with an onset, and maps their pitch to rows 1-6.
+ * Each bar with any notes becomes <base>_NNNN.txt via write_to_txt().
+ *
+ * Both passes split the file between threads, and every thread reads
+ * its own part through a small window, so memory use doesn't grow
+ * with the length of the recording.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  // for malloc()
+#include <string.h>  // for memset()
+#include <math.h>    // for log2(), atan2()
+#include <pthread.h>
+#include <unistd.h>  // for sysconf()
+#include "transcribe.h"
+#include "wav.h"
+#include "fft.h"
+#include "melody.h"
+
+#define TR_NFFT       (TR_WIN*2) // zero-padded FFT size for autocorrelation
+#define TR_RECENT     4          // hops used for the onset baseline
+
+/* Running statistics from pass 1, merged across threads */
+typedef struct {
+  double phase_c[TR_MAX_K+1];  // sum of cos(2 pi k t) over onsets
+  double phase_s[TR_MAX_K+1];  // sum of sin(2 pi k t) over onsets
+  double pitch_class[12];      // onset energy per pitch class
+  double note_hist[128];       // onset energy per MIDI note
+  long long onsets;
+} TrStats;
+
+/* Per-thread work buffers */
+typedef struct {
+  float *re, *im;              // FFT buffers
+  float *win;                  // pitch analysis window
+  float *hop;                  // one hop of input
+} TrBufs;
+
+/* Per-thread arguments */
+typedef struct {
+  const char *path;
+  long long start, end;        // pass 1: frame range
+  long long bar_start, bar_end;// pass 2: bar range
+  TrStats stats;
+  /* Pass 2 settings, shared by all threads */
+  int k, scale, start_note;
+  double grid_start;           // frame of the first step
+  const char *out_base;
+  int bars_written;
+  int err;
+} TrJob;
+
+static const int degrees[3][6] = {
+  {0, 0, 0, 0, 0, 0},
+  {0, 2, 4, 7, 9, 12},         // SCALE_MAJ
+  {0, 3, 5, 7, 10, 12},        // SCALE_MIN
+};
+
+static int alloc_bufs(TrBufs *b)
+{
+  b->re = malloc(TR_NFFT * sizeof(float));
+  b->im = malloc(TR_NFFT * sizeof(float));
+  b->win = malloc(TR_WIN * sizeof(float));
+  b->hop = malloc(TR_HOP * sizeof(float));
+  return (b->re && b->im && b->win && b->hop) ? 0 : -1;
+}
+
+static void free_bufs(TrBufs *b)
+{
+  free(b->re);
+  free(b->im);
+  free(b->win);
+  free(b->hop);
+}
+
+static double rms(const float *x, int n)
+{
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += x[i]*x[i];
+  return n ? sqrt(sum/n) : 0;
+}
+
+static double detect_pitch(TrBufs *b, const float *x, int n, int rate)
+{
+  /* McLeod normalized square difference function, with the
+     autocorrelation computed by FFT. Returns 0 if unpitched. */
+  int min_lag = rate / TR_MAX_FREQ;
+  int max_lag = rate / TR_MIN_FREQ;
+  int last = max_lag + max_lag/4; // so the longest period's lobe can end
+  double m, nsdf, prev, best = 0, key_max[64], key_val;
+  int key_lag[64], nkeys = 0, lag = 0, in_peak = 0, i;
+
+  if (last > n/2)
+    last = n/2;
+
+  for (i = 0; i < TR_NFFT; i++) {
+    b->re[i] = i < n ? x[i] : 0;
+    b->im[i] = 0;
+  }
+  fft(b->re, b->im, TR_NFFT);
+  for (i = 0; i < TR_NFFT; i++) {
+    b->re[i] = b->re[i]*b->re[i] + b->im[i]*b->im[i];
+    b->im[i] = 0;
+  }
+  // The power spectrum is real and even, so a forward FFT inverts it
+  fft(b->re, b->im, TR_NFFT);
+
+  /* m(lag) = sum of x[j]^2 + x[j+lag]^2, updated incrementally */
+  m = 0;
+  for (i = 0; i < n; i++)
+    m += 2*x[i]*x[i];
+  if (m <= 0)
+    return 0;
+
+  prev = 1;
+  key_val = 0;
+  for (i = 1; i <= last && nkeys < 64; i++) {
+    m -= x[i-1]*x[i-1] + x[n-i]*x[n-i];
+    nsdf = m > 0 ? 2*(b->re[i]/TR_NFFT)/m : 0;
+
+    // Track the highest point of each positive lobe after the first dip
+    if (prev < 0 && nsdf >= 0) {
+      in_peak = 1;
+      key_val = 0;
+    } else if (prev >= 0 && nsdf < 0 && in_peak) {
+      in_peak = 0;
+      key_max[nkeys] = key_val;
+      key_lag[nkeys++] = lag;
+    }
+    if (in_peak && nsdf > key_val && i >= min_lag && i <= max_lag) {
+      key_val = nsdf;
+      lag = i;
+    }
+    prev = nsdf;
+  }
+  // A lobe still open at the end counts if it peaked in range
+  if (in_peak && key_val > 0 && nkeys < 64) {
+    key_max[nkeys] = key_val;
+    key_lag[nkeys++] = lag;
+  }
+
+  for (i = 0; i < nkeys; i++)
+    if (key_max[i] > best)
+      best = key_max[i];
+  if (best < TR_CLARITY)
+    return 0;
+
+  // First key maximum close to the best one is the period
+  for (i = 0; i < nkeys; i++)
+    if (key_max[i] >= 0.9*best)
+      return (double)rate / key_lag[i];
+  return 0;
+}
+
+static double freq_to_midi(double freq)
+{
+  /* Inverse of convert_to_freq(): A3 = 57 = 220 Hz */
+  return 57 + 12*log2(freq/220.0);
+}
+
+static void *pass1(void *arg)
+{
+  /* Detects onsets in [start, end) and adds them to the statistics. */
+  TrJob *job = arg;
+  TrStats *st = &job->stats;
+  WavFile wf;
+  TrBufs b;
+  double recent[TR_RECENT], level, hop_level, base, t, freq, midi;
+  long long pos, last_onset = -1, pending = -1;
+  int refractory, filled = 0, note;
+
+  if (wav_open_read(&wf, job->path) < 0 || alloc_bufs(&b) < 0) {
+    job->err = 1;
+    return NULL;
+  }
+  refractory = TR_REFRACTORY * wf.samp_rate;
+  for (int i = 0; i < TR_RECENT; i++)
+    recent[i] = 0;
+  memset(b.win, 0, TR_WIN * sizeof(float));
+
+  // Start a little early so the onset baseline is warm at the boundary
+  pos = job->start - TR_RECENT*TR_HOP;
+  if (pos < 0)
+    pos = 0;
+  wav_seek(&wf, pos);
+
+  while (pos < job->end && wav_read_mono(&wf, b.hop, TR_HOP) == TR_HOP) {
+    // Keep the last TR_WIN samples for pitch detection
+    memmove(b.win, b.win + TR_HOP, (TR_WIN - TR_HOP) * sizeof(float));
+    memcpy(b.win + TR_WIN - TR_HOP, b.hop, TR_HOP * sizeof(float));
+    filled += TR_HOP;
+
+    hop_level = rms(b.hop, TR_HOP);
+    base = recent[0];
+    for (int i = 1; i < TR_RECENT; i++)
+      if (recent[i] < base)
+        base = recent[i];
+    if (base < TR_SILENCE)
+      base = TR_SILENCE;
+
+    if (pos >= job->start && hop_level > TR_ONSET_RATIO*base &&
+        (last_onset < 0 || pos - last_onset > refractory)) {
+      last_onset = pos;
+      t = (double)pos / wf.samp_rate;
+      for (int k = TR_MIN_K; k <= TR_MAX_K; k++) {
+        st->phase_c[k] += cos(2*PI*k*t);
+        st->phase_s[k] += sin(2*PI*k*t);
+      }
+      st->onsets++;
+      // Measure pitch once the window covers the note, past its attack
+      pending = pos + TR_WIN;
+    }
+
+    if (pending >= 0 && pos + TR_HOP >= pending && filled >= TR_WIN) {
+      pending = -1;
+      freq = detect_pitch(&b, b.win, TR_WIN, wf.samp_rate);
+      if (freq > 0) {
+        midi = freq_to_midi(freq);
+        note = (int)floor(midi + 0.5);
+        if (note >= 0 && note < 128) {
+          level = rms(b.win, TR_WIN);
+          st->note_hist[note] += level;
+          st->pitch_class[note % 12] += level;
+        }
+      }
+    }
+
+    memmove(recent, recent + 1, (TR_RECENT - 1) * sizeof(double));
+    recent[TR_RECENT-1] = hop_level;
+    pos += TR_HOP;
+  }
+
+  free_bufs(&b);
+  wav_close(&wf);
+  return NULL;
+}
+
+static int quantize_row(double freq, int scale, int start_note)
+{
+  /* Maps a frequency to the nearest row 1-6 of the scale,
+     folding octaves into the one-octave range of the grid. */
+  int d = (int)floor(freq_to_midi(freq) + 0.5) - start_note;
+  int best = 0;
+
+  while (d < 0)
+    d += 12;
+  while (d > 12)
+    d -= 12;
+  for (int i = 1; i < 6; i++)
+    if (abs(degrees[scale][i] - d) < abs(degrees[scale][best] - d))
+      best = i;
+  return best + 1;
+}
+
+static void *pass2(void *arg)
+{
+  /* Transcribes bars [bar_start, bar_end) into melody files. */
+  TrJob *job = arg;
+  WavFile wf;
+  TrBufs b;
+  Melody mel;
+  char name[1024];
+  double step_len, level, base, recent[TR_RECENT], freq;
+  long long fs, pos, from, to, onset;
+  int any;
+
+  if (wav_open_read(&wf, job->path) < 0 || alloc_bufs(&b) < 0) {
+    job->err = 1;
+    return NULL;
+  }
+  step_len = (double)wf.samp_rate / job->k;
+
+  mel.filename = name;
+  mel.tempo = 15 * job->k;
+  mel.scale = job->scale;
+  mel.start_note = job->start_note;
+
+  for (long long bar = job->bar_start; bar < job->bar_end; bar++) {
+    any = 0;
+    for (int s = 0; s < NUM_COLS; s++) {
+      mel.notes[s] = 0;
+      fs = (long long)(job->grid_start + (bar*NUM_COLS + s)*step_len);
+
+      /* Look for an onset nearest this step: within half a step */
+      from = fs - (long long)(step_len/2);
+      to = fs + (long long)(step_len/2);
+      pos = from - TR_RECENT*TR_HOP;
+      if (pos < 0)
+        pos = 0;
+      wav_seek(&wf, pos);
+      onset = -1;
+      for (int i = 0; i < TR_RECENT; i++)
+        recent[i] = 0;
+      while (pos < to && wav_read_mono(&wf, b.hop, TR_HOP) == TR_HOP) {
+        level = rms(b.hop, TR_HOP);
+        base = recent[0];
+        for (int i = 1; i < TR_RECENT; i++)
+          if (recent[i] < base)
+            base = recent[i];
+        if (base < TR_SILENCE)
+          base = TR_SILENCE;
+        if (pos >= from && level > TR_ONSET_RATIO*base) {
+          onset = pos;
+          break;
+        }
+        memmove(recent, recent + 1, (TR_RECENT - 1) * sizeof(double));
+        recent[TR_RECENT-1] = level;
+        pos += TR_HOP;
+      }
+      if (onset < 0)
+        continue;
+
+      /* Pitch of the note just after its onset */
+      wav_seek(&wf, onset + TR_HOP);
+      if (wav_read_mono(&wf, b.win, TR_WIN) != TR_WIN)
+        continue;
+      freq = detect_pitch(&b, b.win, TR_WIN, wf.samp_rate);
+      if (freq > 0) {
+        mel.notes[s] = quantize_row(freq, job->scale, job->start_note);
+        any = 1;
+      }
+    }
+
+    // Silent bars are not worth a file
+    if (!any)
+      continue;
+    snprintf(name, sizeof(name), "%s_%04lld.txt", job->out_base, bar);
+    if (write_to_txt(&mel) < 0) {
+      job->err = 1;
+      break;
+    }
+    job->bars_written++;
+  }
+
+  free_bufs(&b);
+  wav_close(&wf);
+  return NULL;
+}
+
+static void fit_key(TrStats *st, int *scale, int *start_note)
+{
+  /* Picks the root and scale whose pentatonic set holds the most
+     onset energy, breaking major/relative-minor ties on the root,
+     then the octave that holds the most notes. */
+  double score, best = -1, sum;
+  int root = 0;
+
+  *scale = SCALE_MAJ;
+  for (int sc = SCALE_MAJ; sc <= SCALE_MIN; sc++) {
+    for (int r = 0; r < 12; r++) {
+      score = 0;
+      for (int i = 0; i < 5; i++)
+        score += st->pitch_class[(r + degrees[sc][i]) % 12];
+      score += 0.5 * st->pitch_class[r];
+      if (score > best) {
+        best = score;
+        root = r;
+        *scale = sc;
+      }
+    }
+  }
+
+  best = -1;
+  *start_note = 48 + root;
+  for (int n = 24 + root; n <= 84; n += 12) {
+    sum = 0;
+    for (int i = n; i <= n + 12 && i < 128; i++)
+      sum += st->note_hist[i];
+    if (sum > best) {
+      best = sum;
+      *start_note = n;
+    }
+  }
+}
+
+static void fit_grid(TrStats *st, int rate, int *k, double *grid_start)
+{
+  /* Picks the slowest step rate whose grid lines up with the onsets
+     nearly as well as the best one (any multiple of the true rate
+     lines up too), and the offset of that grid. */
+  double r[TR_MAX_K+1], best = 0, phase;
+
+  for (int i = TR_MIN_K; i <= TR_MAX_K; i++) {
+    r[i] = st->onsets ? hypot(st->phase_c[i], st->phase_s[i]) / st->onsets : 0;
+    if (r[i] > best)
+      best = r[i];
+  }
+  *k = TR_MAX_K;
+  for (int i = TR_MIN_K; i <= TR_MAX_K; i++) {
+    if (r[i] >= 0.9*best) {
+      *k = i;
+      break;
+    }
+  }
+
+  // Offset in -0.5..0.5 steps, so the first step may start before the file
+  phase = atan2(st->phase_s[*k], st->phase_c[*k]) / (2*PI);
+  *grid_start = phase * rate / *k;
+}
+
+static int start_threads(pthread_t *threads, int num_threads,
+  void *(*fn)(void *), void *jobs, size_t job_size)
+{
+  /* Starts fn on each job. Returns how many threads started; if that
+     is fewer than asked for, those started must still be joined. */
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, fn, (char *)jobs + i * job_size)
+        != 0) {
+      fprintf(stderr, "ERROR: could not start thread %d of %d\n", i + 1,
+        num_threads);
+      return i;
+    }
+  }
+  return num_threads;
+}
+
+int transcribe_wav(const char *wav_path, const char *out_base, int num_threads)
+{
+  /* Transcribes a recording into one melody file per 16-step bar.
+     Returns the number of melodies written, or -1 on error. */
+  WavFile wf;
+  TrJob *jobs;
+  pthread_t *threads;
+  TrStats total;
+  long long num_frames, bars, per;
+  int rate, k, scale, start_note, written = 0, err = 0, started;
+  double grid_start;
+
+  if (wav_open_read(&wf, wav_path) < 0)
+    return -1;
+  num_frames = wf.num_frames;
+  rate = wf.samp_rate;
+  wav_close(&wf);
+
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads <= 0)
+    num_threads = 1;
+
+  jobs = calloc(num_threads, sizeof(TrJob));
+  threads = calloc(num_threads, sizeof(pthread_t));
+  if (!jobs || !threads) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    free(jobs);
+    free(threads);
+    return -1;
+  }
+
+  /* Pass 1: statistics, each thread over an equal slice of the file */
+  per = (num_frames + num_threads - 1) / num_threads;
+  for (int i = 0; i < num_threads; i++) {
+    jobs[i].path = wav_path;
+    jobs[i].start = i * per;
+    jobs[i].end = (i + 1) * per < num_frames ? (i + 1) * per : num_frames;
+  }
+  started = start_threads(threads, num_threads, pass1, jobs, sizeof(TrJob));
+  err = started < num_threads;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    err |= jobs[i].err;
+    for (int j = 0; j <= TR_MAX_K; j++) {
+      total.phase_c[j] += jobs[i].stats.phase_c[j];
+      total.phase_s[j] += jobs[i].stats.phase_s[j];
+    }
+    for (int j = 0; j < 12; j++)
+      total.pitch_class[j] += jobs[i].stats.pitch_class[j];
+    for (int j = 0; j < 128; j++)
+      total.note_hist[j] += jobs[i].stats.note_hist[j];
+    total.onsets += jobs[i].stats.onsets;
+  }
+  if (err || total.onsets == 0) {
+    if (!err)
+      fprintf(stderr, "ERROR: no notes found in %s\n", wav_path);
+    free(jobs);
+    free(threads);
+    return -1;
+  }
+
+  fit_grid(&total, rate, &k, &grid_start);
+  fit_key(&total, &scale, &start_note);
+  fprintf(stderr, "%s: %lld onsets, tempo %d, scale %d, start note %d\n",
+    wav_path, total.onsets, 15*k, scale, start_note);
+
+  /* Pass 2: bars, each thread over an equal run of bars */
+  bars = (long long)ceil((num_frames - grid_start) / (NUM_COLS * (double)rate / k));
+  per = (bars + num_threads - 1) / num_threads;
+  for (int i = 0; i < num_threads; i++) {
+    jobs[i].bar_start = i * per;
+    jobs[i].bar_end = (i + 1) * per < bars ? (i + 1) * per : bars;
+    jobs[i].k = k;
+    jobs[i].scale = scale;
+    jobs[i].start_note = start_note;
+    jobs[i].grid_start = grid_start;
+    jobs[i].out_base = out_base;
+  }
+  started = start_threads(threads, num_threads, pass2, jobs, sizeof(TrJob));
+  err |= started < num_threads;
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    err |= jobs[i].err;
+    written += jobs[i].bars_written;
+  }
+  fprintf(stderr, "%s: wrote %d of %lld bars\n", wav_path, written, bars);
+
+  free(jobs);
+  free(threads);
+  return err ? -1 : written;
+}
@@ -0,0 +1,19 @@
+#ifndef _TRANSCRIBE_H_
+#define _TRANSCRIBE_H_
+
+#define TR_WIN          4096   // pitch analysis window (samples): over
+                               // 4 periods of TR_MIN_FREQ at 48 kHz
+#define TR_HOP          256    // onset analysis hop (samples)
+#define TR_MIN_FREQ     50.0   // lowest pitch detected (Hz)
+#define TR_MAX_FREQ     1500.0 // highest pitch detected (Hz)
+#define TR_SILENCE      0.003  // RMS below this (about -50 dBFS) is silence
+#define TR_ONSET_RATIO  2.0    // RMS rise over the recent minimum for an onset
+#define TR_REFRACTORY   0.05   // minimum seconds between onsets
+#define TR_CLARITY      0.6    // minimum normalized autocorrelation for a pitch
+#define TR_MIN_K        2      // slowest step rate tried (steps per second)
+#define TR_MAX_K        16     // fastest step rate tried (steps per second)
+
+/* transcribe.c function prototypes */
+int transcribe_wav(const char *wav_path, const char *out_base, int num_threads);
+
+#endif
@@ -0,0 +1,308 @@
+#define _FILE_OFFSET_BITS 64 // for fseeko() past 2 GB
+#include <stdio.h>
+#include <string.h> // for memcmp()
+#include <fcntl.h>  // for posix_fallocate()
+#include <unistd.h> // for pwrite()
+#include "wav.h"
+
+#define WAV_READ_CHUNK  1024 // frames converted per fread()
+
+static unsigned int get_u32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+  p[0] = v; p[1] = v >> 8;
+}
+
+int wav_open_read(WavFile *wf, const char *path)
+{
+  /* Opens a WAV file and finds its fmt and data chunks.
+     Supports 16/24/32-bit PCM and 32-bit float. */
+  unsigned char hdr[12], chunk[8], fmt[40], ds64[28];
+  unsigned long long size, data_size64 = 0;
+  int have_fmt = 0;
+
+  memset(wf, 0, sizeof(*wf));
+  wf->fp = fopen(path, "rb");
+  if (!wf->fp) {
+    fprintf(stderr, "ERROR: could not open %s\n", path);
+    return -1;
+  }
+
+  if (fread(hdr, 1, 12, wf->fp) != 12 || (memcmp(hdr, "RIFF", 4) != 0 &&
+      memcmp(hdr, "RF64", 4) != 0) || memcmp(hdr+8, "WAVE", 4) != 0) {
+    fprintf(stderr, "ERROR: %s is not a WAV file\n", path);
+    goto fail;
+  }
+
+  /* Walk the chunks until the data chunk */
+  while (fread(chunk, 1, 8, wf->fp) == 8) {
+    size = get_u32(chunk+4);
+    if (memcmp(chunk, "ds64", 4) == 0) {
+      // RF64: the real sizes of the chunks marked 0xFFFFFFFF
+      if (size < 28 || fread(ds64, 1, 28, wf->fp) != 28)
+        break;
+      data_size64 = get_u32(ds64+8) |
+        (unsigned long long)get_u32(ds64+12) << 32;
+      fseeko(wf->fp, size - 28 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "fmt ", 4) == 0) {
+      if (size < 16 || size > sizeof(fmt) ||
+          fread(fmt, 1, size, wf->fp) != size)
+        break;
+      wf->format = get_u16(fmt);
+      wf->num_chan = get_u16(fmt+2);
+      wf->samp_rate = get_u32(fmt+4);
+      wf->bits = get_u16(fmt+14);
+      // Extensible files carry the real format in the sub-format GUID
+      if (wf->format == WAV_FMT_EXT && size >= 26)
+        wf->format = get_u16(fmt+24);
+      have_fmt = 1;
+      if (size & 1)
+        fseeko(wf->fp, 1, SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_fmt)
+        break;
+      // Check the format before sizes are worked out from it
+      if (wf->num_chan < 1 || wf->samp_rate < 1 ||
+          !((wf->format == WAV_FMT_PCM && (wf->bits == 16 || wf->bits == 24 ||
+          wf->bits == 32)) || (wf->format == WAV_FMT_FLOAT && wf->bits == 32))) {
+        fprintf(stderr, "ERROR: %s: unsupported sample format\n", path);
+        goto fail;
+      }
+      if (size == 0xFFFFFFFF && data_size64)
+        size = data_size64;
+      wf->data_offset = ftello(wf->fp);
+      wf->num_frames = size / (wf->num_chan * (wf->bits/8));
+      return 0;
+    } else {
+      // Skip chunks we don't care about (padded to even size)
+      fseeko(wf->fp, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fprintf(stderr, "ERROR: %s: missing fmt or data chunk\n", path);
+
+fail:
+  fclose(wf->fp);
+  wf->fp = NULL;
+  return -1;
+}
+
+int wav_seek(WavFile *wf, long long frame)
+{
+  /* Moves the read position to the given frame. */
+  if (frame < 0)
+    frame = 0;
+  if (frame > wf->num_frames)
+    frame = wf->num_frames;
+  return fseeko(wf->fp, wf->data_offset +
+    frame * wf->num_chan * (wf->bits/8), SEEK_SET);
+}
+
+long wav_read_mono(WavFile *wf, float *buf, long frames)
+{
+  /* Reads up to frames frames from the current position,
+     mixing all channels down to mono floats in -1..1.
+     Returns the number of frames read. */
+  unsigned char raw[WAV_READ_CHUNK * 4 * 8];
+  int bytes = wf->bits / 8;
+  int frame_bytes = bytes * wf->num_chan;
+  long chunk_frames = sizeof(raw) / frame_bytes;
+  long done = 0, n, k;
+  const unsigned char *p;
+  float v;
+
+  while (done < frames) {
+    n = frames - done;
+    if (n > chunk_frames)
+      n = chunk_frames;
+    n = fread(raw, frame_bytes, n, wf->fp);
+    if (n <= 0)
+      break;
+
+    p = raw;
+    for (long i = 0; i < n; i++) {
+      v = 0;
+      for (k = 0; k < wf->num_chan; k++) {
+        if (wf->format == WAV_FMT_FLOAT) {
+          float f;
+          memcpy(&f, p, 4);
+          v += f;
+        } else if (bytes == 2) {
+          v += (short)get_u16(p) / 32768.0f;
+        } else if (bytes == 3) {
+          int s24 = p[0] | (p[1] << 8) | (p[2] << 16);
+          v += ((s24 << 8) >> 8) / 8388608.0f; // sign-extend
+        } else {
+          v += (int)get_u32(p) / 2147483648.0f;
+        }
+        p += bytes;
+      }
+      buf[done + i] = v / wf->num_chan;
+    }
+    done += n;
+  }
+  return done;
+}
+
+static int write_header(WavFile *wf)
+{
+  /* Writes the header for the file's current length. Up to 4 GB it is
+     plain RIFF with a JUNK chunk holding the place of a ds64 chunk;
+     past that it turns into RF64 (EBU Tech 3306), with the real sizes
+     in the ds64 chunk and all-ones in the 32-bit ones. */
+  unsigned char hdr[WAV_HEADER_BYTES];
+  int frame_bytes = wf->num_chan * (wf->bits/8);
+  unsigned long long data_bytes = wf->num_frames * frame_bytes;
+  unsigned long long riff_bytes = WAV_HEADER_BYTES - 8 + data_bytes +
+    (data_bytes & 1);
+  int rf64 = riff_bytes > 0xFFFFFFFFULL;
+
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(hdr, rf64 ? "RF64" : "RIFF", 4);
+  put_u32(hdr+4, rf64 ? 0xFFFFFFFF : riff_bytes);
+  memcpy(hdr+8, "WAVE", 4);
+  memcpy(hdr+12, rf64 ? "ds64" : "JUNK", 4);
+  put_u32(hdr+16, 28);
+  if (rf64) {
+    put_u32(hdr+20, riff_bytes);
+    put_u32(hdr+24, riff_bytes >> 32);
+    put_u32(hdr+28, data_bytes);
+    put_u32(hdr+32, data_bytes >> 32);
+    put_u32(hdr+36, wf->num_frames);
+    put_u32(hdr+40, wf->num_frames >> 32);
+    // hdr+44: no table of other chunk sizes
+  }
+  memcpy(hdr+48, "fmt ", 4);
+  put_u32(hdr+52, 16);
+  put_u16(hdr+56, wf->format);
+  put_u16(hdr+58, wf->num_chan);
+  put_u32(hdr+60, wf->samp_rate);
+  put_u32(hdr+64, wf->samp_rate * frame_bytes);
+  put_u16(hdr+68, frame_bytes);
+  put_u16(hdr+70, wf->bits);
+  memcpy(hdr+72, "data", 4);
+  put_u32(hdr+76, rf64 ? 0xFFFFFFFF : data_bytes);
+
+  if (pwrite(fileno(wf->fp), hdr, sizeof(hdr), 0) != sizeof(hdr))
+    return -1;
+  return 0;
+}
+
+int wav_create(WavFile *wf, const char *path, int samp_rate, int num_chan,
+  int bits, int format, long long num_frames)
+{
+  /* Creates a WAV file for num_frames frames, with its header already
+     final and the data area allocated, so that the samples can be
+     written in any order, from any thread, with wav_pwrite(). With
+     num_frames < 0 the length is not known yet: samples are appended
+     with wav_write() and wav_close() fills in the header. */
+  int frame_bytes = num_chan * (bits/8);
+  long long data_bytes;
+
+  memset(wf, 0, sizeof(*wf));
+  wf->fp = fopen(path, "wb+");
+  if (!wf->fp) {
+    fprintf(stderr, "ERROR: could not create %s\n", path);
+    return -1;
+  }
+  wf->samp_rate = samp_rate;
+  wf->num_chan = num_chan;
+  wf->bits = bits;
+  wf->format = format;
+  wf->data_offset = WAV_HEADER_BYTES;
+  wf->num_frames = num_frames < 0 ? 0 : num_frames;
+  wf->append = num_frames < 0;
+  data_bytes = wf->num_frames * frame_bytes;
+
+  if (write_header(wf) < 0 ||
+      fseeko(wf->fp, WAV_HEADER_BYTES, SEEK_SET) != 0) {
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+    goto fail;
+  }
+  if (wf->append)
+    return 0;
+  // Reserve the whole file now, so a full disk shows up before rendering
+  data_bytes += data_bytes & 1;
+#ifdef __linux__
+  if (posix_fallocate(fileno(wf->fp), 0, WAV_HEADER_BYTES + data_bytes) != 0)
+#else
+  if (ftruncate(fileno(wf->fp), WAV_HEADER_BYTES + data_bytes) != 0)
+#endif
+  {
+    fprintf(stderr, "ERROR: could not allocate %lld bytes for %s\n",
+      WAV_HEADER_BYTES + data_bytes, path);
+    goto fail;
+  }
+  return 0;
+
+fail:
+  fclose(wf->fp);
+  wf->fp = NULL;
+  return -1;
+}
+
+int wav_pwrite(WavFile *wf, const void *buf, long long frame, long frames)
+{
+  /* Writes frames frames of samples, already in the file's format,
+     at the given frame. Safe to call from several threads at once. */
+  int frame_bytes = wf->num_chan * (wf->bits/8);
+  const char *p = buf;
+  size_t left = (size_t)frames * frame_bytes;
+  off_t pos = wf->data_offset + frame * frame_bytes;
+  ssize_t n;
+
+  while (left > 0) {
+    n = pwrite(fileno(wf->fp), p, left, pos);
+    if (n <= 0)
+      return -1;
+    p += n;
+    pos += n;
+    left -= n;
+  }
+  return 0;
+}
+
+int wav_write(WavFile *wf, const void *buf, long frames)
+{
+  /* Appends frames frames of samples, already in the file's format,
+     to a file created with an unknown length. */
+  if (fwrite(buf, wf->num_chan * (wf->bits/8), frames, wf->fp) !=
+      (size_t)frames)
+    return -1;
+  wf->num_frames += frames;
+  return 0;
+}
+
+int wav_close(WavFile *wf)
+{
+  /* Closes the file. A file written with wav_write() gets its final
+     header first. Returns -1 if that could not be written. */
+  long long data_bytes = wf->num_frames * wf->num_chan * (wf->bits/8);
+  int ret = 0;
+
+  if (!wf->fp)
+    return 0;
+  if (wf->append) {
+    if ((data_bytes & 1) && fputc(0, wf->fp) == EOF)
+      ret = -1;
+    if (fflush(wf->fp) != 0 || write_header(wf) < 0)
+      ret = -1;
+  }
+  if (fclose(wf->fp) != 0)
+    ret = -1;
+  wf->fp = NULL;
+  return ret;
+}
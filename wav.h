@@ -0,0 +1,34 @@
+#ifndef _WAV_H_
+#define _WAV_H_
+
+#include <stdio.h>
+
+#define WAV_HEADER_BYTES 80 // header written by wav_create(), room for RF64
+
+#define WAV_FMT_PCM     1   // WAVE_FORMAT_PCM
+#define WAV_FMT_FLOAT   3   // WAVE_FORMAT_IEEE_FLOAT
+#define WAV_FMT_EXT     0xFFFE // WAVE_FORMAT_EXTENSIBLE
+
+/* An open WAV file */
+typedef struct {
+  FILE *fp;
+  int samp_rate;               // sampling rate in Hz
+  int num_chan;                // number of interleaved channels
+  int bits;                    // bits per sample: 16, 24 or 32
+  int format;                  // WAV_FMT_PCM or WAV_FMT_FLOAT
+  long long data_offset;       // byte offset of the first sample
+  long long num_frames;        // length in frames
+  int append;                  // written with wav_write(), length not final
+} WavFile;
+
+/* wav.c function prototypes */
+int wav_open_read(WavFile *wf, const char *path);
+int wav_seek(WavFile *wf, long long frame);
+long wav_read_mono(WavFile *wf, float *buf, long frames);
+int wav_create(WavFile *wf, const char *path, int samp_rate, int num_chan,
+  int bits, int format, long long num_frames);
+int wav_pwrite(WavFile *wf, const void *buf, long long frame, long frames);
+int wav_write(WavFile *wf, const void *buf, long frames);
+int wav_close(WavFile *wf);
+
+#endif